@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+
+#include "gameplay.h"
+#include "admin.h"
+#include "room.h"
+#include "round.h"
+#include "evil.h"
+#include "wordlist.h"
+#include "netio.h"
+#include "metrics.h"
+#include "clock.h"
+#include "log.h"
+
+struct admin_conn {
+    int fd;                 // -1 if the slot is free
+    char in[ADMIN_LINE];    // Commands not yet run
+    int in_len;
+    char *out;              // The answer being built this turn
+    int out_len;
+    int out_cap;
+    int next_fd;            // Where the clients listing got to, or -1
+};
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct admin_conn conns[ADMIN_MAX_CONNS];
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        exit(1);
+    }
+}
+
+// Listen for the console on a Unix socket at path, replacing an old socket
+void admin_open(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Admin socket path %s is too long\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(socket_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+    // Only a socket left behind by an earlier run is replaced
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", path);
+            exit(1);
+        }
+        unlink(path);
+    }
+    // The console can kick players and see every room's word, so only
+    // this user may connect to it
+    mode_t mask = umask(077);
+    int bound = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound == -1) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(listen_fd, ADMIN_MAX_CONNS) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    set_nonblocking(listen_fd);
+    if (netio_listen(listen_fd) == -1) {
+        exit(1);
+    }
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        conns[i].fd = -1;
+    }
+    printf("Admin console on %s\n", path);
+}
+
+static void drop(struct admin_conn *c) {
+    netio_remove(c->fd);
+    close(c->fd);
+    c->fd = -1;
+    free(c->out);
+    c->out = NULL;
+    c->out_cap = 0;
+}
+
+void admin_close(void) {
+    if (listen_fd == -1) {
+        return;
+    }
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (conns[i].fd != -1) {
+            drop(&conns[i]);
+        }
+    }
+    netio_remove(listen_fd);
+    close(listen_fd);
+    unlink(socket_path);
+    listen_fd = -1;
+}
+
+static struct admin_conn *conn_of(int fd) {
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (conns[i].fd == fd) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
+
+// Whether fd is the console's listening socket or one of its connections
+int admin_owns(int fd) {
+    return fd != -1 && (fd == listen_fd || conn_of(fd) != NULL);
+}
+
+static void accept_conn(void) {
+    int fd = netio_accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+        return;
+    }
+    struct admin_conn *c = conn_of(-1);
+    if (c == NULL || netio_add(fd) == -1) {
+        close(fd);
+        return;
+    }
+    set_nonblocking(fd);
+    c->fd = fd;
+    c->in_len = 0;
+    c->out_len = 0;
+    c->next_fd = -1;
+}
+
+/* Read what is ready on fd, one of the console's sockets. Commands are
+ * only queued here; admin_run runs them.
+ */
+void admin_ready(int fd) {
+    if (fd == listen_fd) {
+        accept_conn();
+        return;
+    }
+    struct admin_conn *c = conn_of(fd);
+    if (c->in_len == ADMIN_LINE) {
+        // Wait for admin_run to make space, unless a line that long is
+        // all there is
+        if (memchr(c->in, '\n', c->in_len) == NULL) {
+            drop(c);
+        }
+        return;
+    }
+    int n = netio_read(fd, c->in + c->in_len, ADMIN_LINE - c->in_len);
+    if (n <= 0) {
+        if (n == 0 || errno != EAGAIN) {
+            drop(c);
+        }
+        return;
+    }
+    c->in_len += n;
+}
+
+static void reply(struct admin_conn *c, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        int room = c->out_cap - c->out_len;
+        va_start(ap, fmt);
+        int n = vsnprintf(c->out + c->out_len, room, fmt, ap);
+        va_end(ap);
+        if (n < room) {
+            c->out_len += n;
+            return;
+        }
+        c->out_cap = c->out_cap ? c->out_cap * 2 : 4096;
+        while (c->out_cap - c->out_len <= n) {
+            c->out_cap *= 2;
+        }
+        c->out = realloc(c->out, c->out_cap);
+        if (c->out == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+}
+
+static const char *mode_of(struct game_state *room) {
+    if (room->round_ms != 0) {
+        return room->evil != NULL ? "rounds, adversarial" : "rounds";
+    }
+    return room->evil != NULL ? "turns, adversarial" : "turns";
+}
+
+static void list_rooms(struct admin_conn *c) {
+    reply(c, "%-6s %-12s %-7s %-8s %-20s %-20s %s\n", "room", "words",
+          "players", "watching", "mode", "guess", "left");
+    for (struct game_state *room = rooms_active(); room != NULL;
+         room = room->next_room) {
+        if (room->head == NULL) {
+            continue;    // Closes at the next tick
+        }
+        reply(c, "%-6d %-12s %-7d %-8d %-20s %-20s %d\n", room->id,
+              room->words->name, linked_list_size(room->head),
+              room->spectators.count, mode_of(room), room->guess,
+              room->guesses_left);
+    }
+}
+
+static void dump_room(struct admin_conn *c, struct game_state *room) {
+    long long now = now_ms();
+    reply(c, "room %d: word list %s, %s\n", room->id, room->words->name,
+          mode_of(room));
+    reply(c, "word %s, guessed so far %s, %d guesses left\n", room->word,
+          room->guess, room->guesses_left);
+    reply(c, "letters guessed:");
+    for (int i = 0; i < NUM_LETTERS; i++) {
+        if (room->letters_guessed[i]) {
+            reply(c, " %c", 'a' + i);
+        }
+    }
+    reply(c, "\nlast move %lld ms ago\n", now - room->move_start);
+    reply(c, "deck: %u of %u words dealt this cycle, %u swaps kept\n",
+          room->deck.dealt, room->deck.size, room->deck.nswaps);
+    if (room->evil != NULL) {
+        reply(c, "adversarial: %d candidate words\n", room->evil->remaining);
+    }
+    if (room->round_ms != 0) {
+        if (room->round_end == 0) {
+            reply(c, "round: none open\n");
+        } else {
+            reply(c, "round: closes in %lld ms, letters %.*s\n",
+                  room->round_end - now, room->round_nletters,
+                  room->round_order);
+        }
+    }
+    reply(c, "players, in turn order:\n");
+    for (struct client *p = room->head; p != NULL; p = p->next) {
+        reply(c, "  %-30s fd %-5d score %-3d%s", p->name, p->fd, p->score,
+              p == room->has_next_turn && room->round_ms == 0 ?
+              " (to move)" : "");
+        if (p->round_guess != '\0') {
+            reply(c, " guessed %c", p->round_guess);
+        }
+        reply(c, "\n");
+    }
+    struct room_spectators *s = &room->spectators;
+    reply(c, "spectators %d, frame %u (%d bytes) still owed to %d\n",
+          s->count, s->version, s->frame.len, s->stale);
+}
+
+static const char *state_of(struct client *p) {
+    switch (p->state) {
+    case CLIENT_NEW:
+        return "naming";
+    case CLIENT_LOBBY:
+        return "lobby";
+    case CLIENT_PLAYING:
+        return "playing";
+    default:
+        return "watching";
+    }
+}
+
+/* List up to ADMIN_CLIENTS_PER_TURN clients, from c->next_fd on. Leaves
+ * next_fd where the next turn should carry on, or -1 when done.
+ */
+static void list_clients(struct admin_conn *c) {
+    int maxfd = netio_maxfd();
+    int listed = 0;
+    if (c->next_fd == 0) {
+        reply(c, "%-5s %-16s %-8s %-5s %-15s %-6s %-6s %-6s %-7s %s\n",
+              "fd", "name", "state", "room", "address", "inbuf", "inq",
+              "outq", "strikes", "rtt_us");
+    }
+    int fd;
+    for (fd = c->next_fd; fd <= maxfd; fd++) {
+        struct client *p = find_client(fd);
+        if (p == NULL) {
+            continue;
+        }
+        if (listed++ == ADMIN_CLIENTS_PER_TURN) {
+            c->next_fd = fd;
+            return;
+        }
+        // What the kernel holds for the client each way
+        int inq = -1;
+        int outq = -1;
+        ioctl(fd, SIOCINQ, &inq);
+        ioctl(fd, SIOCOUTQ, &outq);
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        long rtt = -1;
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            rtt = info.tcpi_rtt;
+        }
+        char room[12] = "-";
+        if (p->room != NULL) {
+            sprintf(room, "%d", p->room->id);
+        }
+        reply(c, "%-5d %-16s %-8s %-5s %-15s %-6d %-6d %-6d %-7d %ld\n",
+              fd, p->name[0] ? p->name : "-", state_of(p), room,
+              inet_ntoa(p->ipaddr), (int)(p->in_ptr - p->inbuf), inq, outq,
+              p->limit.strikes, rtt);
+    }
+    c->next_fd = -1;
+}
+
+static struct client *client_named(const char *name) {
+    int maxfd = netio_maxfd();
+    for (int fd = 0; fd <= maxfd; fd++) {
+        struct client *p = find_client(fd);
+        if (p != NULL && p->state != CLIENT_NEW &&
+            strcmp(p->name, name) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void show_metrics(struct admin_conn *c) {
+    char *text;
+    size_t len;
+    FILE *out = open_memstream(&text, &len);
+    if (out == NULL) {
+        reply(c, "error: %s\n", strerror(errno));
+        return;
+    }
+    print_metrics(out);
+    fprintf(out, "rooms %d\n", rooms_count());
+    fclose(out);
+    reply(c, "%s", text);
+    free(text);
+}
+
+static void run_command(struct admin_conn *c, char *line,
+                        struct client **new_players) {
+    char *cmd = strtok(line, " \t");
+    char *arg = strtok(NULL, " \t");
+    if (cmd == NULL) {
+        return;
+    }
+    if (strcmp(cmd, "rooms") == 0) {
+        list_rooms(c);
+    } else if (strcmp(cmd, "room") == 0 || strcmp(cmd, "newround") == 0) {
+        struct game_state *room = NULL;
+        if (arg != NULL) {
+            room = room_find(strtol(arg, NULL, 10));
+        }
+        if (room == NULL) {
+            reply(c, "error: no such room\n");
+        } else if (strcmp(cmd, "room") == 0) {
+            dump_room(c, room);
+        } else {
+            room_restart(room, new_players);
+            reply(c, "ok\n");
+        }
+    } else if (strcmp(cmd, "clients") == 0) {
+        c->next_fd = 0;
+        list_clients(c);
+    } else if (strcmp(cmd, "kick") == 0) {
+        struct client *p = arg != NULL ? client_named(arg) : NULL;
+        if (p == NULL) {
+            reply(c, "error: no player called that\n");
+            return;
+        }
+        log_info("Admin kicked %s\n", p->name);
+        char *msg = "You have been removed from the server\r\n";
+        // Removing the player drops anything still queued for it
+        netio_send_now(p->fd, msg, strlen(msg));
+        safe_remove(p->room, new_players, p->fd);
+        reply(c, "ok\n");
+    } else if (strcmp(cmd, "loglevel") == 0) {
+        if (arg != NULL) {
+            int level = log_level_parse(arg);
+            if (level == -1) {
+                reply(c, "error: levels are quiet, info and debug\n");
+                return;
+            }
+            log_level = level;
+        }
+        reply(c, "%s\n", log_level_name(log_level));
+    } else if (strcmp(cmd, "metrics") == 0) {
+        show_metrics(c);
+    } else {
+        reply(c, "commands: rooms, room <id>, clients, kick <name>, "
+              "newround <id>, loglevel [quiet|info|debug], metrics\n");
+    }
+}
+
+// Send c's answer, dropping c if it isn't reading fast enough
+static void flush_reply(struct admin_conn *c) {
+    if (c->out_len == 0) {
+        return;
+    }
+    int n = write(c->fd, c->out, c->out_len);
+    if (n != c->out_len) {
+        drop(c);
+        return;
+    }
+    c->out_len = 0;
+}
+
+/* Called once per loop turn: run the next command of each console
+ * connection, or carry on with its clients listing. Returns 1 if there
+ * is more to do, so the loop shouldn't wait.
+ */
+int admin_run(struct client **new_players) {
+    int more = 0;
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        struct admin_conn *c = &conns[i];
+        if (c->fd == -1) {
+            continue;
+        }
+        if (c->next_fd != -1) {
+            list_clients(c);
+        } else {
+            char *end = memchr(c->in, '\n', c->in_len);
+            if (end == NULL) {
+                continue;
+            }
+            *end = '\0';
+            if (end > c->in && end[-1] == '\r') {
+                end[-1] = '\0';
+            }
+            run_command(c, c->in, new_players);
+            int used = end + 1 - c->in;
+            memmove(c->in, end + 1, c->in_len - used);
+            c->in_len -= used;
+        }
+        flush_reply(c);
+        if (c->fd != -1 && (c->next_fd != -1 ||
+                            memchr(c->in, '\n', c->in_len) != NULL)) {
+            more = 1;
+        }
+    }
+    return more;
+}
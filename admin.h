@@ -0,0 +1,31 @@
+#ifndef _ADMIN_H_
+#define _ADMIN_H_
+
+#include "gameplay.h"
+
+/* A console for the server's operator on a Unix socket (connect with, for
+ * example, socat - UNIX-CONNECT:<path>). It takes one command per line:
+ *   rooms                 one line for each open room
+ *   room <id>             everything about one room's game
+ *   clients               every connection, with its buffers, rate limit
+ *                         and round trip time
+ *   kick <name>           disconnect a player
+ *   newround <id>         resolve the open round, or start a new game
+ *   loglevel [level]      show or set the log level (quiet, info, debug)
+ *   metrics               the server's counters
+ * Commands are read when they arrive but run at the start of the next loop
+ * turn, at most one per connection per turn, and a long clients listing is
+ * spread over several turns, so the console never holds up the game for
+ * long. Answers that can't be written at once close the connection.
+ */
+#define ADMIN_MAX_CONNS 4
+#define ADMIN_LINE 256
+#define ADMIN_CLIENTS_PER_TURN 128   // Clients listed per loop turn
+
+void admin_open(const char *path);
+void admin_close(void);
+int admin_owns(int fd);
+void admin_ready(int fd);
+int admin_run(struct client **new_players);
+
+#endif
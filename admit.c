@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "admit.h"
+#include "names.h"
+#include "lobby.h"
+#include "wordlist.h"
+#include "trace.h"
+
+// Clients in the greeting or admitting stage, oldest first
+static struct client *head;
+static struct client *tail;
+
+static void enqueue(struct client *p) {
+    p->admit_next = NULL;
+    p->admit_prev = tail;
+    if (tail != NULL) {
+        tail->admit_next = p;
+    } else {
+        head = p;
+    }
+    tail = p;
+}
+
+static void unlink_client(struct client *p) {
+    if (p->admit_prev != NULL) {
+        p->admit_prev->admit_next = p->admit_next;
+    } else {
+        head = p->admit_next;
+    }
+    if (p->admit_next != NULL) {
+        p->admit_next->admit_prev = p->admit_prev;
+    } else {
+        tail = p->admit_prev;
+    }
+    p->admit_next = NULL;
+    p->admit_prev = NULL;
+}
+
+// Queue p, which has just connected, to be asked for its name
+void admit_greet(struct client *p) {
+    p->handshake = HS_GREETING;
+    enqueue(p);
+}
+
+// Queue p, which has answered with name, to have the name checked
+void admit_name(struct client *p, const char *name) {
+    strncpy(p->name, name, MAX_NAME - 1);
+    p->name[MAX_NAME - 1] = '\0';
+    p->handshake = HS_ADMITTING;
+    enqueue(p);
+}
+
+// Take p, a new client that is being removed, off the queue if it is on it
+void admit_forget(struct client *p) {
+    if (p->handshake != HS_NAMING) {
+        unlink_client(p);
+    }
+}
+
+/* Tell p, who has just entered the lobby, that it is waiting for a room,
+ * and which word lists it can pick, in one message
+ */
+static void welcome(struct client *p, struct client **new_players) {
+    char names[MAX_WORD_LISTS * (MAX_NAME + 2)];
+    char *msg = malloc(sizeof(names) + 2 * MAX_MSG);
+    if (msg == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    int len = sprintf(msg, "Correct name! Finding you a room...\r\n");
+    if (word_lists_count() > 1) {
+        sprintf(msg + len, "You will play with the %s word list. Type the "
+                "name of another to switch: %s\r\n", p->words->name,
+                word_list_names(names, sizeof(names)));
+    }
+    Write(p->fd, msg, NULL, new_players);
+    free(msg);
+}
+
+/* Check the name p gave. A valid name is registered and sends p to the
+ * lobby to wait for a room; otherwise p is asked again.
+ */
+static void admit(struct client *p, struct client **new_players) {
+    if (check_name_valid(p->name) != 0) {
+        p->name[0] = '\0';
+        p->handshake = HS_NAMING;
+        Write(p->fd, "This nickname is already in use, or is a blank "
+              "nickname! Please choose another one\n" WELCOME_MSG, NULL,
+              new_players);
+        return;
+    }
+    name_add(p->name);
+    remove_from_new(new_players, p->fd);
+    p->handshake = HS_NAMING;
+    p->words = word_list_get(0);
+    lobby_add(p);
+    welcome(p, new_players);
+}
+
+/* Called once per loop turn: greet or admit up to ADMIT_BATCH queued
+ * clients. Returns 1 if there are more, so the loop shouldn't wait.
+ */
+int admit_run(struct client **new_players) {
+    if (head == NULL) {
+        return 0;
+    }
+    TRACE_BEGIN(admit);
+    for (int i = 0; i < ADMIT_BATCH && head != NULL; i++) {
+        struct client *p = head;
+        unlink_client(p);
+        if (p->handshake == HS_GREETING) {
+            p->handshake = HS_NAMING;
+            Write(p->fd, WELCOME_MSG, NULL, new_players);
+        } else {
+            admit(p, new_players);
+        }
+    }
+    TRACE_END(admit);
+    return head != NULL;
+}
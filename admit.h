@@ -0,0 +1,27 @@
+#ifndef _ADMIT_H_
+#define _ADMIT_H_
+
+#include "gameplay.h"
+
+/* New connections go through a handshake before they reach the lobby:
+ *   - greeting: accepted, waiting to be asked for a name
+ *   - naming: asked, waiting for a line with the name
+ *   - admitting: a name was given, waiting to be checked and registered
+ * Reading the name only moves the client along. The work that touches the
+ * name registry and the lobby, and the greeting and welcome messages, are
+ * done from a queue at most ADMIT_BATCH clients per loop turn, so a wave
+ * of new connections can't hold up the moves of players in rooms. Clients
+ * aren't read from while they wait on the queue.
+ */
+#define ADMIT_BATCH 32
+
+#define HS_GREETING 0
+#define HS_NAMING 1
+#define HS_ADMITTING 2
+
+void admit_greet(struct client *p);
+void admit_name(struct client *p, const char *name);
+void admit_forget(struct client *p);
+int admit_run(struct client **new_players);
+
+#endif
@@ -0,0 +1,20 @@
+#include <time.h>
+
+#include "clock.h"
+
+static long long turn_time = -1;
+
+long long clock_read(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void clock_set(long long ms) {
+    turn_time = ms;
+}
+
+// The time of the current loop turn; the real time until the loop starts
+long long now_ms(void) {
+    return turn_time >= 0 ? turn_time : clock_read();
+}
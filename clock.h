@@ -0,0 +1,13 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+/* Milliseconds on a monotonic clock, for timers and rate limits. The
+ * event loop reads the clock once per turn with clock_read and hands the
+ * reading to clock_set, so everything done in a turn sees the same time
+ * and a replayed session can supply the recorded times instead.
+ */
+long long clock_read(void);
+void clock_set(long long ms);
+long long now_ms(void);
+
+#endif
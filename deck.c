@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deck.h"
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t next(uint64_t *s) {
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+static uint64_t splitmix(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// A uniform number below bound, without modulo bias (Lemire's method)
+static uint32_t below(uint64_t *s, uint32_t bound) {
+    uint64_t m = (uint64_t)(uint32_t)(next(s) >> 32) * bound;
+    if ((uint32_t)m < bound) {
+        uint32_t threshold = -bound % bound;
+        while ((uint32_t)m < threshold) {
+            m = (uint64_t)(uint32_t)(next(s) >> 32) * bound;
+        }
+    }
+    return m >> 32;
+}
+
+static uint32_t slot_of(const struct word_deck *deck, uint32_t pos) {
+    return (pos * 2654435761u) & (deck->capacity - 1);
+}
+
+// The word at pos: whatever was swapped there, or pos itself
+static uint32_t get(const struct word_deck *deck, uint32_t pos) {
+    if (deck->capacity == 0) {
+        return pos;
+    }
+    uint32_t mask = deck->capacity - 1;
+    for (uint32_t i = slot_of(deck, pos); ; i = (i + 1) & mask) {
+        if (deck->swaps[i].pos == 0) {
+            return pos;
+        }
+        if (deck->swaps[i].pos == pos + 1) {
+            return deck->swaps[i].value;
+        }
+    }
+}
+
+static void put(struct word_deck *deck, uint32_t pos, uint32_t value);
+
+// Keep the table at most half full
+static void grow(struct word_deck *deck) {
+    struct swap_slot *old = deck->swaps;
+    uint32_t old_capacity = deck->capacity;
+    deck->capacity = old_capacity ? old_capacity * 2 : 64;
+    deck->swaps = calloc(deck->capacity, sizeof(struct swap_slot));
+    if (deck->swaps == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    deck->nswaps = 0;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].pos != 0) {
+            put(deck, old[i].pos - 1, old[i].value);
+        }
+    }
+    free(old);
+}
+
+static void put(struct word_deck *deck, uint32_t pos, uint32_t value) {
+    if (2 * (deck->nswaps + 1) > deck->capacity) {
+        grow(deck);
+    }
+    uint32_t i = slot_of(deck, pos);
+    while (deck->swaps[i].pos != 0 && deck->swaps[i].pos != pos + 1) {
+        i = (i + 1) & (deck->capacity - 1);
+    }
+    if (deck->swaps[i].pos == 0) {
+        deck->swaps[i].pos = pos + 1;
+        deck->nswaps++;
+    }
+    deck->swaps[i].value = value;
+}
+
+// Start a new cycle through the words, keeping the table's memory
+static void reshuffle(struct word_deck *deck) {
+    deck->dealt = 0;
+    deck->nswaps = 0;
+    if (deck->capacity != 0) {
+        memset(deck->swaps, 0, deck->capacity * sizeof(struct swap_slot));
+    }
+}
+
+/* Deal a new deck of size words, shuffled by a generator seeded from
+ * seed. A deck being reused keeps its table.
+ */
+void deck_init(struct word_deck *deck, uint32_t size, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        deck->rng[i] = splitmix(&seed);
+    }
+    deck->size = size;
+    deck->last = -1;
+    reshuffle(deck);
+}
+
+// The next step of the shuffle: swap a random later word into place
+static uint32_t deal(struct word_deck *deck) {
+    uint32_t i = deck->dealt++;
+    uint32_t j = i + below(deck->rng, deck->size - i);
+    uint32_t word = get(deck, j);
+    if (j != i) {
+        put(deck, j, get(deck, i));
+    }
+    return word;
+}
+
+/* Return the index of the next word in the deck. When every word has been
+ * dealt the deck is reshuffled, and the word that ended a cycle never
+ * starts the next one.
+ */
+uint32_t deck_draw(struct word_deck *deck) {
+    if (deck->dealt == deck->size) {
+        reshuffle(deck);
+    }
+    uint32_t word = deal(deck);
+    if (deck->dealt == 1 && word == deck->last && deck->size > 1) {
+        // Swap it with a word further down the deck
+        uint32_t j = 1 + below(deck->rng, deck->size - 1);
+        uint32_t other = get(deck, j);
+        put(deck, j, word);
+        word = other;
+    }
+    deck->last = word;
+    return word;
+}
+
+void deck_free(struct word_deck *deck) {
+    free(deck->swaps);
+    deck->swaps = NULL;
+    deck->capacity = 0;
+    deck->nswaps = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _DECK_H_
+#define _DECK_H_
+
+#include <stdint.h>
+
+/* A room's deck of words: a shuffle of the word indices, dealt one at a
+ * time, so no word comes up twice until every word has. The shuffle is a
+ * Fisher-Yates run one step per draw. Only the positions a step has
+ * swapped are stored, in a small hash table, so a deck costs memory in
+ * proportion to the words drawn rather than the size of the dictionary.
+ * Each deck has its own xoshiro256** generator.
+ */
+struct swap_slot {
+    uint32_t pos;       // Position + 1, or 0 if the slot is free
+    uint32_t value;     // Word index now at pos
+};
+
+struct word_deck {
+    uint64_t rng[4];
+    uint32_t size;      // Words in the dictionary
+    uint32_t dealt;     // Words dealt this cycle
+    int64_t last;       // Last word dealt, or -1
+    struct swap_slot *swaps;
+    uint32_t nswaps;
+    uint32_t capacity;  // Slots in swaps, a power of two
+};
+
+void deck_init(struct word_deck *deck, uint32_t size, uint64_t seed);
+uint32_t deck_draw(struct word_deck *deck);
+void deck_free(struct word_deck *deck);
+
+#endif
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dict.h"
+
+#define DICT_MAGIC "WGDICT\0"
+#define DICT_VERSION 2
+#define DICT_BLOCK 16       // Words per front-coded block
+#define DICT_ESCAPE 0xff
+
+/* Layout of a dictionary image:
+ *   struct dict_header
+ *   uint32_t blocks[nblocks + 1]  block b is data[blocks[b]..blocks[b+1])
+ *   unsigned char data[]          the front-coded blocks
+ * The words are sorted and front coded in blocks of DICT_BLOCK: each word
+ * is stored as the length of the prefix it shares with the word before it
+ * in the block, then the rest of the word. The first word of a block
+ * shares nothing, so any block can be decoded on its own and the first
+ * words can be binary searched. The prefix and suffix lengths share one
+ * byte when both are below 15, otherwise they follow DICT_ESCAPE in a
+ * byte each.
+ */
+struct dict_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t size;          // Bytes in the whole image, header included
+    uint64_t source_size;   // The word list the image was built from
+    int64_t source_mtime;
+    uint64_t checksum;      // Of everything after the header
+};
+
+static uint64_t checksum(const char *data, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 1099511628211ULL;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Where the image for the dictionary at name is published
+static void shm_path(char *name, char *path) {
+    char real[PATH_MAX];
+    if (realpath(name, real) == NULL) {
+        strncpy(real, name, PATH_MAX - 1);
+        real[PATH_MAX - 1] = '\0';
+    }
+    snprintf(path, PATH_MAX, "%s/wordsrv-%016llx", DICT_SHM_DIR,
+             (unsigned long long)checksum(real, strlen(real)));
+}
+
+static const unsigned char *get_lengths(const unsigned char *in,
+                                        int *prefix, int *suffix) {
+    if (in[0] != DICT_ESCAPE) {
+        *prefix = in[0] >> 4;
+        *suffix = in[0] & 0xf;
+        return in + 1;
+    }
+    *prefix = in[1];
+    *suffix = in[2];
+    return in + 3;
+}
+
+/* Decode the lengths of every word in the count words' nblocks blocks.
+ * Return 0 if each block holds the words it should and ends where the next
+ * begins, and no word shares more than the word before it had or is longer
+ * than 255 bytes, so that decoding a word stays in its block and in a
+ * 256 byte buffer.
+ */
+static int check_blocks(const unsigned char *data, const uint32_t *blocks,
+                        uint32_t nblocks, uint32_t count) {
+    for (uint32_t b = 0; b < nblocks; b++) {
+        const unsigned char *in = data + blocks[b];
+        const unsigned char *end = data + blocks[b + 1];
+        uint32_t words = b == nblocks - 1 ? count - b * DICT_BLOCK
+                                          : DICT_BLOCK;
+        int len = 0;
+        for (uint32_t i = 0; i < words; i++) {
+            int prefix, suffix;
+            if (in >= end || (in[0] == DICT_ESCAPE && end - in < 3)) {
+                return -1;
+            }
+            in = get_lengths(in, &prefix, &suffix);
+            if (prefix > len || prefix + suffix > 255 || suffix > end - in) {
+                return -1;
+            }
+            in += suffix;
+            len = prefix + suffix;
+        }
+        if (in != end) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Return 0 if image is a complete image built from the file described by st
+static int validate(const char *image, size_t size, struct stat *st) {
+    const struct dict_header *h = (const struct dict_header *)image;
+    if (size < sizeof(*h) || memcmp(h->magic, DICT_MAGIC, 8) != 0 ||
+        h->version != DICT_VERSION || h->size != size ||
+        h->source_size != (uint64_t)st->st_size ||
+        h->source_mtime != (int64_t)st->st_mtime) {
+        return -1;
+    }
+    uint32_t nblocks = ((uint64_t)h->count + DICT_BLOCK - 1) / DICT_BLOCK;
+    size_t index_size = sizeof(*h) + (nblocks + 1) * sizeof(uint32_t);
+    if (index_size > size) {
+        return -1;
+    }
+    if (checksum(image + sizeof(*h), size - sizeof(*h)) != h->checksum) {
+        fprintf(stderr, "Shared dictionary image is corrupt; rebuilding\n");
+        return -1;
+    }
+    // Every block must start after the one before it and end in the data
+    const uint32_t *blocks = (const uint32_t *)(image + sizeof(*h));
+    if (blocks[0] != 0 || blocks[nblocks] != size - index_size) {
+        return -1;
+    }
+    for (uint32_t b = 0; b < nblocks; b++) {
+        if (blocks[b] >= blocks[b + 1]) {
+            return -1;
+        }
+    }
+    return check_blocks((const unsigned char *)image + index_size, blocks,
+                        nblocks, h->count);
+}
+
+/* Look up the first word of each block, to check that the blocks are in
+ * the order dict_contains's binary search needs
+ */
+static int check_order(const struct dictionary *dict) {
+    char word[256];
+    for (int i = 0; i < dict->size; i += DICT_BLOCK) {
+        dict_word(dict, i, word, sizeof(word));
+        if (!dict_contains(dict, word)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Map the image at path if it is valid for the file described by st.
+ * DICT_SHM_DIR is writable by everyone, so only a regular file that this
+ * user owns and that nobody else can write is trusted; anything else is
+ * left alone and the caller falls back to a private copy.
+ */
+static int attach(struct dictionary *dict, char *path, struct stat *st) {
+    struct stat shm_st;
+    // O_NONBLOCK so that a FIFO planted at path can't hang the open
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &shm_st) == -1 || !S_ISREG(shm_st.st_mode) ||
+        shm_st.st_uid != geteuid() ||
+        (shm_st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+        shm_st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    char *image = mmap(NULL, shm_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return -1;
+    }
+    if (validate(image, shm_st.st_size, st) != 0) {
+        munmap(image, shm_st.st_size);
+        return -1;
+    }
+    dict->image = image;
+    dict->image_size = shm_st.st_size;
+    dict->shared = 1;
+    dict->size = ((const struct dict_header *)image)->count;
+    if (check_order(dict) != 0) {
+        fprintf(stderr, "Shared dictionary image is out of order; "
+                "rebuilding\n");
+        munmap(image, shm_st.st_size);
+        return -1;
+    }
+    return 0;
+}
+
+struct word_ref {
+    const char *text;
+    size_t len;
+};
+
+static int compare_words(const void *a, const void *b) {
+    const struct word_ref *x = a, *y = b;
+    size_t n = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->text, y->text, n);
+    if (c != 0) {
+        return c;
+    }
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+// Append the lengths of a word's shared prefix and suffix at out
+static size_t put_lengths(unsigned char *out, size_t prefix, size_t suffix) {
+    if (prefix < 15 && suffix < 15) {
+        out[0] = prefix << 4 | suffix;
+        return 1;
+    }
+    out[0] = DICT_ESCAPE;
+    out[1] = prefix;
+    out[2] = suffix;
+    return 3;
+}
+
+/* Build an image from the word list at name, which has been stat'ed into
+ * st. Empty lines, line endings and repeated words are dropped, and the
+ * words are sorted if the list isn't already. Words are cut at 255 bytes.
+ * Returns NULL if the word list can't be opened.
+ */
+static char *build(char *name, struct stat *st, size_t *image_size) {
+    FILE *fp = fopen(name, "r");
+    if (fp == NULL) {
+        perror("Opening dictionary");
+        return NULL;
+    }
+    char *text = malloc(st->st_size + 1);
+    if (text == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t len = fread(text, 1, st->st_size, fp);
+    fclose(fp);
+
+    size_t max_words = 1;
+    for (size_t i = 0; i < len; i++) {
+        max_words += text[i] == '\n';
+    }
+    struct word_ref *words = malloc(max_words * sizeof(struct word_ref));
+    if (words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    uint32_t count = 0;
+    int sorted = 1;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && text[i] != '\n') {
+            continue;
+        }
+        size_t end = i;
+        if (end > start && text[end - 1] == '\r') {
+            end--;
+        }
+        if (end > start) {
+            words[count].text = text + start;
+            words[count].len = end - start > 255 ? 255 : end - start;
+            if (count > 0 && compare_words(&words[count - 1],
+                                           &words[count]) > 0) {
+                sorted = 0;
+            }
+            count++;
+        }
+        start = i + 1;
+    }
+    if (!sorted) {
+        qsort(words, count, sizeof(struct word_ref), compare_words);
+    }
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique == 0 || compare_words(&words[unique - 1], &words[i]) != 0) {
+            words[unique++] = words[i];
+        }
+    }
+    count = unique;
+
+    // Front coding never takes more than the lengths plus the words, so
+    // size the image for that and trim it afterwards
+    uint32_t nblocks = (count + DICT_BLOCK - 1) / DICT_BLOCK;
+    size_t data_max = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        data_max += 3 + words[i].len;
+    }
+    size_t index_size = sizeof(struct dict_header) +
+                        (nblocks + 1) * sizeof(uint32_t);
+    char *image = calloc(1, index_size + data_max);
+    if (image == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    uint32_t *blocks = (uint32_t *)(image + sizeof(struct dict_header));
+    unsigned char *data = (unsigned char *)image + index_size;
+    size_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t prefix = 0;
+        if (i % DICT_BLOCK == 0) {
+            blocks[i / DICT_BLOCK] = used;
+        } else {
+            const struct word_ref *prev = &words[i - 1];
+            while (prefix < prev->len && prefix < words[i].len &&
+                   prev->text[prefix] == words[i].text[prefix]) {
+                prefix++;
+            }
+        }
+        used += put_lengths(data + used, prefix, words[i].len - prefix);
+        memcpy(data + used, words[i].text + prefix, words[i].len - prefix);
+        used += words[i].len - prefix;
+    }
+    blocks[nblocks] = used;
+    free(words);
+    free(text);
+
+    size_t size = index_size + used;
+    struct dict_header *h = (struct dict_header *)image;
+    memcpy(h->magic, DICT_MAGIC, 8);
+    h->version = DICT_VERSION;
+    h->count = count;
+    h->size = size;
+    h->source_size = st->st_size;
+    h->source_mtime = st->st_mtime;
+    h->checksum = checksum(image + sizeof(*h), size - sizeof(*h));
+    *image_size = size;
+    return image;
+}
+
+// Write image under a temporary name and rename it into place, so other
+// processes only ever see complete images
+static int publish(char *path, const char *image, size_t size) {
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, image + done, size - done);
+        if (n <= 0) {
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        done += n;
+    }
+    close(fd);
+    if (rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Open the dictionary at name: attach to its shared image if a valid one
+ * exists, otherwise build it and publish it for the next process.
+ * Returns 0, or -1 if the word list can't be read or has no words.
+ */
+int dict_open(struct dictionary *dict, char *name) {
+    struct stat st;
+    char path[PATH_MAX];
+    dict->name = name;
+    if (stat(name, &st) == -1) {
+        perror("Opening dictionary");
+        return -1;
+    }
+
+    shm_path(name, path);
+    if (attach(dict, path, &st) == 0) {
+        printf("Attached to shared dictionary %s\n", path);
+    } else {
+        size_t size;
+        char *image = build(name, &st, &size);
+        if (image == NULL) {
+            return -1;
+        }
+        if (publish(path, image, size) == 0 && attach(dict, path, &st) == 0) {
+            printf("Published shared dictionary %s\n", path);
+            free(image);
+        } else {
+            fprintf(stderr, "Could not share the dictionary; "
+                    "using a private copy\n");
+            dict->image = image;
+            dict->image_size = size;
+            dict->shared = 0;
+        }
+    }
+    dict->size = ((const struct dict_header *)dict->image)->count;
+    if (dict->size == 0) {
+        fprintf(stderr, "The dictionary %s has no words\n", name);
+        dict_close(dict);
+        return -1;
+    }
+    printf("Dictionary has %d words in %zu bytes (%s is %lld bytes)\n",
+           dict->size, dict->image_size, name, (long long)st.st_size);
+    return 0;
+}
+
+// Let go of the dictionary's image
+void dict_close(struct dictionary *dict) {
+    if (dict->shared) {
+        munmap((void *)dict->image, dict->image_size);
+    } else {
+        free((void *)dict->image);
+    }
+    dict->image = NULL;
+    dict->size = 0;
+}
+
+static const uint32_t *block_index(const struct dictionary *dict) {
+    return (const uint32_t *)(dict->image + sizeof(struct dict_header));
+}
+
+static const unsigned char *block_data(const struct dictionary *dict) {
+    const struct dict_header *h = (const struct dict_header *)dict->image;
+    uint32_t nblocks = (h->count + DICT_BLOCK - 1) / DICT_BLOCK;
+    return (const unsigned char *)(block_index(dict) + nblocks + 1);
+}
+
+/* Copy word index into buf (at most size - 1 characters), and return
+ * its length. Decodes at most DICT_BLOCK words.
+ */
+int dict_word(const struct dictionary *dict, int index, char *buf, int size) {
+    char word[256];
+    const unsigned char *in = block_data(dict) +
+                              block_index(dict)[index / DICT_BLOCK];
+    int len = 0;
+    for (int i = 0; i <= index % DICT_BLOCK; i++) {
+        int prefix, suffix;
+        in = get_lengths(in, &prefix, &suffix);
+        memcpy(word + prefix, in, suffix);
+        in += suffix;
+        len = prefix + suffix;
+    }
+    if (len > size - 1) {
+        len = size - 1;
+    }
+    memcpy(buf, word, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/* Return 1 if word is in the dictionary and 0 otherwise: a binary search
+ * over the first word of each block, then a scan of one block.
+ */
+int dict_contains(const struct dictionary *dict, const char *word) {
+    const struct dict_header *h = (const struct dict_header *)dict->image;
+    const uint32_t *blocks = block_index(dict);
+    const unsigned char *data = block_data(dict);
+    struct word_ref key = {word, strlen(word)};
+    int prefix, suffix;
+
+    // Find the last block whose first word is not after word
+    int lo = 0, hi = (h->count + DICT_BLOCK - 1) / DICT_BLOCK - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        const unsigned char *in = get_lengths(data + blocks[mid],
+                                              &prefix, &suffix);
+        struct word_ref first = {(const char *)in, suffix};
+        if (compare_words(&first, &key) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    char buf[256];
+    const unsigned char *in = data + blocks[lo];
+    const unsigned char *end = data + blocks[lo + 1];
+    while (in < end) {
+        in = get_lengths(in, &prefix, &suffix);
+        memcpy(buf + prefix, in, suffix);
+        in += suffix;
+        struct word_ref cur = {buf, prefix + suffix};
+        int c = compare_words(&cur, &key);
+        if (c == 0) {
+            return 1;
+        }
+        if (c > 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
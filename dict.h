@@ -0,0 +1,32 @@
+#ifndef _DICT_H_
+#define _DICT_H_
+
+#include <stddef.h>
+
+/* The dictionary is loaded once into a compact image of the sorted,
+ * front-coded words that gives O(1) access to any word by index and
+ * O(log n) membership tests. The image is published read-only in DICT_SHM_DIR,
+ * keyed by the dictionary's path, so every server on the host that uses
+ * the same dictionary maps the same pages instead of loading its own copy.
+ * The image records the size and modification time of the file it was
+ * built from and a checksum, and is rebuilt if either no longer matches.
+ * An image is only mapped if it is a regular file owned by this user that
+ * no one else can write.
+ */
+#define DICT_SHM_DIR "/dev/shm"
+
+// Information about the dictionary used to pick random word
+struct dictionary {
+    char *name;         // Path of the word list
+    const char *image;  // Mapped (or private) dictionary image
+    size_t image_size;
+    int shared;         // 1 if image is mapped from DICT_SHM_DIR
+    int size;           // Number of words
+};
+
+int dict_open(struct dictionary *dict, char *name);
+void dict_close(struct dictionary *dict);
+int dict_word(const struct dictionary *dict, int index, char *buf, int size);
+int dict_contains(const struct dictionary *dict, const char *word);
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "evil.h"
+#include "log.h"
+
+/* The bitset for a letter at a position. For one guess the bitsets of
+ * every position of that letter are read block by block, so they are
+ * kept next to each other.
+ */
+static const uint64_t *letter_bits(const struct evil_words *w, int letter,
+                                   int len, int pos) {
+    return w->bits + ((size_t)letter * len + pos) * w->nblocks;
+}
+
+static void *alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* Group the words of the dictionary by length, and build the
+ * letter-position bitsets for each group.
+ */
+void evil_index_build(struct evil_index *index,
+                      const struct dictionary *dict) {
+    char buf[MAX_WORD];
+    int len;
+    memset(index, 0, sizeof(*index));
+
+    // First pass: how many words of each length
+    for (int i = 0; i < dict->size; i++) {
+        len = dict_word(dict, i, buf, MAX_WORD);
+        index->by_len[len].count++;
+    }
+    for (len = 1; len < MAX_WORD; len++) {
+        struct evil_words *w = &index->by_len[len];
+        if (w->count == 0) {
+            continue;
+        }
+        w->nblocks = (w->count + 63) / 64;
+        w->words = alloc((size_t)w->count * len);
+        w->bits = alloc(sizeof(uint64_t) * NUM_LETTERS * len * w->nblocks);
+        if (w->count > index->largest) {
+            index->largest = w->count;
+        }
+        index->longest = len;
+        w->count = 0;   // refilled by the second pass
+    }
+
+    // Second pass: store the words and set their bits
+    for (int j = 0; j < dict->size; j++) {
+        len = dict_word(dict, j, buf, MAX_WORD);
+        struct evil_words *w = &index->by_len[len];
+        int i = w->count++;
+        memcpy(w->words + (size_t)i * len, buf, len);
+        for (int pos = 0; pos < len; pos++) {
+            if (buf[pos] >= 'a' && buf[pos] <= 'z') {
+                uint64_t *bits = (uint64_t *)letter_bits(w, buf[pos] - 'a',
+                                                         len, pos);
+                bits[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+    }
+    log_info("Indexed %d words for adversarial mode\n", dict->size);
+}
+
+struct evil_game *evil_game_new(const struct evil_index *index) {
+    struct evil_game *evil = alloc(sizeof(struct evil_game));
+    evil->index = index;
+
+    // There can't be more distinct patterns than candidates, or than
+    // subsets of positions in the longest word
+    int patterns = index->largest;
+    if (index->longest < 20 && (1 << index->longest) < patterns) {
+        patterns = 1 << index->longest;
+    }
+    evil->table_size = 16;
+    while (evil->table_size < 2 * patterns) {
+        evil->table_size *= 2;
+    }
+    evil->table = alloc(sizeof(struct pattern_slot) * evil->table_size);
+    evil->used = alloc(sizeof(int) * evil->table_size);
+    evil->alive = alloc(sizeof(uint64_t) * ((index->largest + 63) / 64));
+    return evil;
+}
+
+void evil_index_free(struct evil_index *index) {
+    for (int len = 1; len < MAX_WORD; len++) {
+        free(index->by_len[len].words);
+        free(index->by_len[len].bits);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+void evil_game_free(struct evil_game *evil) {
+    free(evil->table);
+    free(evil->used);
+    free(evil->alive);
+    free(evil);
+}
+
+// Copy the first remaining candidate into word
+static void pick_word(struct evil_game *evil, char *word) {
+    const struct evil_words *w = &evil->index->by_len[evil->len];
+    for (int b = 0; b < w->nblocks; b++) {
+        if (evil->alive[b]) {
+            int i = b * 64 + __builtin_ctzll(evil->alive[b]);
+            memcpy(word, w->words + (size_t)i * evil->len, evil->len);
+            word[evil->len] = '\0';
+            return;
+        }
+    }
+}
+
+/* Start a game with every word as long as word still a candidate.
+ * word is left as is, since it is one of them. Return -1 if the index
+ * has no words of that length.
+ */
+int evil_start(struct evil_game *evil, char *word) {
+    int len = strlen(word);
+    if (len >= MAX_WORD || evil->index->by_len[len].count == 0) {
+        return -1;
+    }
+    const struct evil_words *w = &evil->index->by_len[len];
+    evil->len = len;
+    evil->remaining = w->count;
+    for (int b = 0; b < w->nblocks; b++) {
+        evil->alive[b] = ~0ULL;
+    }
+    if (w->count % 64) {
+        evil->alive[w->nblocks - 1] = (1ULL << (w->count % 64)) - 1;
+    }
+    return 0;
+}
+
+/* For the 64 candidates in block b, find which ones contain letter, and
+ * the positions of letter in each of those (in masks, indexed by bit).
+ */
+static uint64_t block_masks(const struct evil_game *evil, int letter, int b,
+                            uint32_t masks[64]) {
+    const struct evil_words *w = &evil->index->by_len[evil->len];
+    uint64_t alive = evil->alive[b];
+    uint64_t found = 0;
+    for (int pos = 0; pos < evil->len; pos++) {
+        uint64_t hits = letter_bits(w, letter, evil->len, pos)[b] & alive;
+        uint64_t fresh = hits & ~found;
+        while (fresh) {
+            masks[__builtin_ctzll(fresh)] = 0;
+            fresh &= fresh - 1;
+        }
+        found |= hits;
+        while (hits) {
+            masks[__builtin_ctzll(hits)] |= 1u << pos;
+            hits &= hits - 1;
+        }
+    }
+    return found;
+}
+
+// Add one candidate with the given pattern to this move's counts
+static void count_pattern(struct evil_game *evil, uint32_t mask, int *nused) {
+    unsigned int i = (mask * 2654435761u) & (evil->table_size - 1);
+    while (evil->table[i].stamp == evil->stamp &&
+           evil->table[i].mask != mask) {
+        i = (i + 1) & (evil->table_size - 1);
+    }
+    struct pattern_slot *slot = &evil->table[i];
+    if (slot->stamp != evil->stamp) {
+        slot->stamp = evil->stamp;
+        slot->mask = mask;
+        slot->count = 0;
+        evil->used[(*nused)++] = i;
+    }
+    slot->count++;
+}
+
+/* Apply a guess of a valid, not yet guessed letter: keep the biggest group
+ * of candidates that agree on where the letter is (preferring groups that
+ * reveal less), and copy one of them into word so the rest of the game
+ * logic can check and reveal the guess against it.
+ * Return the number of candidates left.
+ */
+int evil_guess(struct evil_game *evil, char guess, char *word) {
+    const struct evil_words *w = &evil->index->by_len[evil->len];
+    int letter = guess - 'a';
+    uint32_t masks[64];
+    int nused = 0;
+
+    if (letter < 0 || letter >= NUM_LETTERS) {
+        return evil->remaining;
+    }
+
+    // Count the candidates in each pattern; mask 0 means a miss
+    evil->stamp++;
+    int misses = 0;
+    for (int b = 0; b < w->nblocks; b++) {
+        if (evil->alive[b] == 0) {
+            continue;
+        }
+        uint64_t found = block_masks(evil, letter, b, masks);
+        misses += __builtin_popcountll(evil->alive[b] & ~found);
+        while (found) {
+            count_pattern(evil, masks[__builtin_ctzll(found)], &nused);
+            found &= found - 1;
+        }
+    }
+
+    uint32_t best = 0;
+    int best_count = misses;
+    for (int j = 0; j < nused; j++) {
+        struct pattern_slot *slot = &evil->table[evil->used[j]];
+        if (slot->count > best_count ||
+            (slot->count == best_count &&
+             __builtin_popcount(slot->mask) < __builtin_popcount(best))) {
+            best = slot->mask;
+            best_count = slot->count;
+        }
+    }
+
+    // Keep only the winning group
+    for (int b = 0; b < w->nblocks; b++) {
+        if (evil->alive[b] == 0) {
+            continue;
+        }
+        uint64_t found = block_masks(evil, letter, b, masks);
+        if (best == 0) {
+            evil->alive[b] &= ~found;
+            continue;
+        }
+        uint64_t keep = 0;
+        while (found) {
+            int i = __builtin_ctzll(found);
+            if (masks[i] == best) {
+                keep |= 1ULL << i;
+            }
+            found &= found - 1;
+        }
+        evil->alive[b] = keep;
+    }
+    evil->remaining = best_count;
+    pick_word(evil, word);
+    return best_count;
+}
@@ -0,0 +1,60 @@
+#ifndef _EVIL_H_
+#define _EVIL_H_
+
+#include <stdint.h>
+
+#include "gameplay.h"
+
+/* Adversarial mode: instead of committing to one word, the server keeps
+ * every dictionary word that is consistent with what has been revealed.
+ * On each guess the candidates are split by where the guessed letter
+ * appears in them, and the largest group survives.
+ */
+
+/* All dictionary words of one length, stored column-wise: for every
+ * position and letter there is a bitset over the words, so one guess
+ * looks at 64 candidates per machine word.
+ */
+struct evil_words {
+    int count;
+    int nblocks;        // 64-bit words per bitset
+    char *words;        // count words of the same length, not terminated
+    uint64_t *bits;     // see letter_bits in evil.c for the layout
+};
+
+// Read-only and shared by every game using the same dictionary
+struct evil_index {
+    struct evil_words by_len[MAX_WORD];
+    int largest;        // most words of any one length
+    int longest;        // longest word length
+};
+
+struct pattern_slot {
+    uint32_t mask;      // positions the guessed letter occupies
+    unsigned stamp;     // slot is in use if this equals the game's stamp
+    int count;
+};
+
+/* The per-game candidate set and the scratch space a move needs; all of
+ * it is allocated once so a move never allocates.
+ */
+struct evil_game {
+    const struct evil_index *index;
+    int len;
+    int remaining;
+    uint64_t *alive;                // bitset of remaining candidates
+    struct pattern_slot *table;     // open addressing, table_size slots
+    int *used;                      // slots filled during this move
+    int table_size;
+    unsigned stamp;
+};
+
+void evil_index_build(struct evil_index *index,
+                      const struct dictionary *dict);
+void evil_index_free(struct evil_index *index);
+struct evil_game *evil_game_new(const struct evil_index *index);
+void evil_game_free(struct evil_game *evil);
+int evil_start(struct evil_game *evil, char *word);
+int evil_guess(struct evil_game *evil, char guess, char *word);
+
+#endif
@@ -4,11 +4,20 @@
 #include <string.h>
 
 #include "gameplay.h"
+#include "netio.h"
+#include "evil.h"
+#include "trace.h"
+#include "names.h"
+#include "lobby.h"
+#include "clock.h"
+#include "log.h"
+#include "admit.h"
 
 /* Return a status message that shows the current state of the game.
  * Assumes that the caller has allocated MAX_MSG bytes for msg.
  */
 char *status_message(char *msg, struct game_state *game) {
+    TRACE_BEGIN(status_message);
     sprintf(msg, "***************\r\n"
            "Word to guess: %s\r\nGuesses remaining: %d\r\n"
            "Letters guessed: \r\n", game->guess, game->guesses_left);
@@ -21,82 +30,47 @@ char *status_message(char *msg, struct game_state *game) {
         }
     }
     strncat(msg, "\r\n***************\r\n", MAX_MSG);
+    TRACE_END(status_message);
     return msg;
 }
 
 
 /* Initialize the gameboard: 
- *    - initialize dictionary
- *    - select a random word to guess from the dictionary file
+ *    - draw the next word to guess from the game's deck; the dictionary
+ *      must already be open
  *    - set guess to all dashes ('-')
  *    - initialize the other fields
  * We can't initialize head and has_next_turn because these will have
  * different values when we use init_game to create a new game after one
  * has already been played
  */
-void init_game(struct game_state *game, char *dict_name) {
-    char buf[MAX_WORD];
-    if(game->dict.fp != NULL) {
-        rewind(game->dict.fp);
-    } else {
-        game->dict.fp = fopen(dict_name, "r");
-        if(game->dict.fp == NULL) {
-            perror("Opening dictionary");
-            exit(1);
-        }
-    } 
-
-    int index = random() % game->dict.size;
-    printf("Looking for word at index %d\n", index);
-    for(int i = 0; i <= index; i++) {
-        if(!fgets(buf, MAX_WORD, game->dict.fp)){
-            fprintf(stderr,"File ended before we found the entry index %d",
-            index);
-            exit(1);
-        }
-    } 
-
-    // Found word
-    if(buf[strlen(buf) - 1] == '\n') {  // from a unix file
-        buf[strlen(buf) - 1] = '\0';
-    } else {
-        fprintf(stderr, "The dictionary file does not appear "
-                "to have Unix line endings\n");
-    }
-    strncpy(game->word, buf, MAX_WORD);
-    game->word[MAX_WORD-1] = '\0';
+void init_game(struct game_state *game) {
+    TRACE_BEGIN(init_game);
+    int index = deck_draw(&game->deck);
+    log_debug("Looking for word at index %d\n", index);
+    dict_word(game->dict, index, game->word, MAX_WORD);
     for(int j = 0; j < strlen(game->word); j++) {
         game->guess[j] = '-';
     }
     game->guess[strlen(game->word)] = '\0';
 
+    // In adversarial mode the word only fixes the length; every word of
+    // that length is a candidate until guesses rule it out
+    if(game->evil != NULL && evil_start(game->evil, game->word) == 0) {
+        log_debug("Adversarial game with %d candidates\n", 
+               game->evil->remaining);
+    }
+
     for(int i = 0; i < NUM_LETTERS; i++) {
         game->letters_guessed[i] = 0;
     }
     game->guesses_left = MAX_GUESSES;
-	fprintf(stdout, "A new game has begun\n");
+    game->move_start = now_ms();
+	log_debug("A new game has begun\n");
+    TRACE_END(init_game);
 }
 
 
-/* Return the number of lines in the file
- */
-int get_file_length(char *filename) {
-    char buf[MAX_MSG];
-    int count = 0;
-    FILE *fp;
-    if((fp = fopen(filename, "r")) == NULL) {
-        perror("open");
-        exit(1);
-    }
-    
-    while(fgets(buf, MAX_MSG, fp) != NULL) {
-        count++;
-    }
-    
-    fclose(fp);
-    return count;
-}
-
 //Tells us the length of a char array. Assume null terminated and at most 20 
 //chars else returns -1
 int find_char_array_length(char *char_array){
@@ -114,7 +88,8 @@ int find_char_array_length(char *char_array){
 //Write a message, usually to a client using error checking.
 void Write(int fd, char *message, struct game_state *game, 
 			struct client **new_players){
-	int write_status = write(fd, message, strlen(message));
+	TRACE_BEGIN(Write);
+	int write_status = netio_send(fd, message, strlen(message));
 	if (write_status == -1){
 		safe_remove(game, new_players, fd);
 	}
@@ -122,33 +97,34 @@ void Write(int fd, char *message, struct game_state *game,
 		fprintf(stderr, "The message '%s' was not "
 				"written to client %d properly", message, fd);
 	}
+	TRACE_END(Write);
 }
 //Check whether name is valid by comparing it to the empty string and to
-// each name of current players
-int check_name_valid(char *buf, struct game_state state){
+// the names of everyone in the lobby or a room
+int check_name_valid(char *buf){
 	if(strcmp(buf, "") == 0){
 		return 1;	
 	}
-	struct client *cur_client = state.head;
-	while(cur_client != NULL){
-		if(strcmp(cur_client->name, buf) == 0){
-			return 1;		
-		}
-		cur_client = cur_client->next;	
+	if(name_taken(buf)){
+		return 1;
 	}
-	fprintf(stdout, "Name was valid\n");
+	log_debug("Name was valid\n");
 	return 0;
 	
 }
 void broadcast(struct game_state *game, char *outbuf){
+	TRACE_BEGIN(broadcast);
 	struct client *cur_client = game->head;
 	while(cur_client){
-		if(write(cur_client->fd, outbuf, strlen(outbuf)) != strlen(outbuf)){
+		if(netio_send(cur_client->fd, outbuf, strlen(outbuf)) != 
+		   strlen(outbuf)){
 			perror("Write to client");
 			fprintf(stderr, "Write to client failed in broadcast function");
 		}
 		cur_client = cur_client->next;
 	}
+	spectate_append(game, outbuf);
+	TRACE_END(broadcast);
 }
 
 /*
@@ -205,7 +181,7 @@ int is_game_over(struct game_state *game){
 			return 0; //At least one more letter to guess
 		}
 	}
-	fprintf(stdout, "The game is over\n");
+	log_debug("The game is over\n");
 	return 1;
 }
 //Tells us whether the game has a winner or everyone lost; ASSUMES GAME IS 
@@ -216,9 +192,9 @@ int has_winner(struct game_state *game){
 	if(is_game_over(game)){
 		if (game->guesses_left == 0){
 			return -1;
-			fprintf(stdout, "There is no winner\n");
+			log_debug("There is no winner\n");
 		}
-		fprintf(stdout, "The winner is %s\n", game->has_next_turn->name);
+		log_debug("The winner is %s\n", game->has_next_turn->name);
 		return game->has_next_turn->fd;
 	}
 	fprintf(stderr, "Game is not over and thus no winner..yet\n");
@@ -228,13 +204,13 @@ int has_winner(struct game_state *game){
 //and if so, if it hadn't been guessed before. 1 if invalid, 0 if valid
 int valid_guess(struct game_state *game, char guess){
 	if (!(guess >= 'a' && guess <= 'z')){
-		fprintf(stdout, "%s made an invalid guess\n", 
+		log_debug("%s made an invalid guess\n", 
 				game->has_next_turn->name);
 		return 1;
 	}
 	else{
 		if(game->letters_guessed[guess - 97] == 1){
-			fprintf(stdout, "%s made an invalid guess\n", 
+			log_debug("%s made an invalid guess\n", 
 					game->has_next_turn->name);
 		}
 		return game->letters_guessed[guess - 97]; 
@@ -248,12 +224,12 @@ int correct_guess(struct game_state *game, char guess){
 	int word_length = find_char_array_length(game->word);
 	for(int i = 0; i < word_length; i++){
 		if (game->word[i] == guess){
-			fprintf(stdout, "%s made a correct guess\n", 
+			log_debug("%s made a correct guess\n", 
 					game->has_next_turn->name);
 			return 0; 
 		}
 	}
-	fprintf(stdout, "%s made an incorrect guess\n", game->has_next_turn->name);
+	log_debug("%s made an incorrect guess\n", game->has_next_turn->name);
 	return 1;
 }
 //Checks a move, and tells us whether the guess was correct. 
@@ -299,36 +275,49 @@ void update_letters_guessed(struct game_state *game, char guess){
 	game->letters_guessed[guess - 97] = 1;
 }
 
+//Applies a valid guess of a letter that hasn't been guessed yet to the game,
+//whoever made it. Returns the number of letters revealed, 0 if it was wrong
+int apply_guess(struct game_state *game, char guess){
+	if (game->evil != NULL){
+		//Narrow the candidates first; the guess is then right or wrong
+		//against the word that was kept
+		evil_guess(game->evil, guess, game->word);
+	}
+	int revealed = 0;
+	int word_length = find_char_array_length(game->word);
+	for(int i = 0; i < word_length; i++){
+		if (game->word[i] == guess){
+			revealed++;
+		}
+	}
+	if (revealed == 0){
+		game->guesses_left -= 1; //Guess only decreases if incorrect and valid
+	}
+	else {
+		update_guess_array(game, guess);
+	}
+	update_letters_guessed(game, guess);
+	return revealed;
+}
+
 //Tries to perform a move, and tells us whether the guess was correct. 
 //-3 if game_over, -2 if wrong player, -1 if invalid guess, 0 if right guess, 
 //and 1 if wrong guess
 int make_move(struct game_state *game, char guess, int p_id){
 	int move_status = check_move(game, guess, p_id);
 	if (move_status < 0){
-		
 		return move_status;
 	}
-	
-	else if (move_status == 1){
-		game->guesses_left -= 1; //Guess only decreases if incorrect and valid
-		update_letters_guessed(game, guess);
+	if (apply_guess(game, guess) == 0){
 		advance_turn(game);
 		return 1;
 	}
-	else if (move_status == 0){//Guess was both valid and correct
-		update_guess_array(game, guess);
-		update_letters_guessed(game, guess);
-		return 0;
-	}
-	else {
-		fprintf(stderr, "This is weird...make_move function\n");
-		return -1; //Note: For error checking only
-	}
+	return 0;
 }
 //Prints out the correct strings to the given clients
 void handle_move_attempt(struct game_state *game, int move_attempt, int cur_fd, 
 						 char guess, char *guesser, struct client *new_players){
-	printf("The word is %s\n", game->word);
+	log_debug("The word is %s\n", game->word);
 	char buffer[150];
 	if (move_attempt == -3){
 		Write(cur_fd, "Game is over! No moves allowed!\r\n", 
@@ -342,27 +331,27 @@ void handle_move_attempt(struct game_state *game, int move_attempt, int cur_fd,
 	   		  "again with a single lowercase letter\r\n", game, &new_players);
 	}
 	else if (move_attempt == 1){
-		sprintf(buffer, "%s guessed %s, which was incorrect.\r\n", 
-				guesser, &guess);
+		sprintf(buffer, "%s guessed %c, which was incorrect.\r\n", 
+				guesser, guess);
 		broadcast(game, buffer);
 		char msg[MAX_BUF];
 		broadcast(game, status_message(msg, game));
 		sprintf(buffer, "It is now %s's turn!\r\n", game->has_next_turn->name);
 		broadcast(game, buffer);
-		fprintf(stdout, "It is now %s's turn!\r\n", game->has_next_turn->name);
+		log_debug("It is now %s's turn!\r\n", game->has_next_turn->name);
 		Write(game->has_next_turn->fd, "It is your turn! "
 			  "Please provide a guess\r\n", game, &new_players);
 	}
 	else if (move_attempt == 0){
 		char msg[MAX_BUF];
-		sprintf(buffer, "%s guessed %s, which was correct!\r\n",
-				guesser, &guess);
+		sprintf(buffer, "%s guessed %c, which was correct!\r\n",
+				guesser, guess);
 		broadcast(game, buffer);
 		char *cur_state = status_message(msg, game);
 		broadcast(game, cur_state);
 		sprintf(buffer, "It is now %s's turn!\r\n", game->has_next_turn->name);
 		broadcast(game, buffer);
-		fprintf(stdout, "It is now %s's turn!\r\n", game->has_next_turn->name);
+		log_debug("It is now %s's turn!\r\n", game->has_next_turn->name);
 		Write(game->has_next_turn->fd, 
 			  "It is your turn! Please provide a guess\r\n", game, 
 			  &new_players);
@@ -372,33 +361,68 @@ void handle_move_attempt(struct game_state *game, int move_attempt, int cur_fd,
 	}	
 }
 
+//Unlinks p from the list of players starting at *top, without freeing it
+static void unlink_player(struct client **top, struct client *p){
+	struct client **cur = top;
+	while (*cur != NULL && *cur != p){
+		cur = &(*cur)->next;
+	}
+	if (*cur != NULL){
+		*cur = p->next;
+	}
+	p->next = NULL;
+}
+
 //Removes a player safely when they disconnect by checking if they are a new
-//player, if it is currently their turn, and if they are the last player left
-//in the game
+//player, waiting in the lobby, watching a room, if it is currently their
+//turn, and if they are the last player left in their room. game is not
+//used; the room is the one the player is in
 void safe_remove(struct game_state *game, struct client **new_players, int fd){
-	char *removed_player = NULL;
-	struct client *found_new_player = find_player(*new_players, fd);
-	struct client *found_active_player = find_player(game->head, fd);
-	if (found_new_player != NULL){//If the guy was still in new
-		removed_player = found_new_player->name;
+	struct client *found = find_client(fd);
+	if (found == NULL){
+		fprintf(stderr, "This is weird...safe_remove\n");
+		return;
+	}
+	if (found->state == CLIENT_NEW){//If the guy was still in new
+		admit_forget(found);
 		remove_player(new_players, fd);
+		return;
 	}
-	else if (found_active_player != NULL){//If active player
-		removed_player = found_active_player->name;
-		if (linked_list_size(game->head) == 1){//Last player leaving!
-			game->has_next_turn = NULL;
+	if (found->state == CLIENT_LOBBY){//Still waiting for a room
+		lobby_remove(found);
+		return;
+	}
+	if (found->state == CLIENT_WATCHING){//Not one of the players
+		spectate_remove(found);
+		return;
+	}
+	leave_room(found, new_players);
+	// remove_player finds the player at the head of a list of its own
+	struct client *top = found;
+	remove_player(&top, fd);
+}
+//Takes a player out of their room, telling the others, and passing the turn
+//on if it was theirs. The player is not freed or disconnected
+void leave_room(struct client *found, struct client **new_players){
+	char removed_player[MAX_NAME];
+	struct game_state *game = found->room;
+	int fd = found->fd;
+	strcpy(removed_player, found->name);
+	if (linked_list_size(game->head) == 1){//Last player leaving!
+		game->has_next_turn = NULL;
+		char buf[150];
+		sprintf(buf, "%s has left the game\r\n", removed_player);
+		broadcast(game, buf);
+		unlink_player(&(game->head), found);
+	}
+	else {//Still other players
+		if (game->has_next_turn->fd == fd){//It's this guy's turn!
+			advance_turn(game);
+			unlink_player(&(game->head), found);
 			char buf[150];
 			sprintf(buf, "%s has left the game\r\n", removed_player);
 			broadcast(game, buf);
-			remove_player(&(game->head), fd);
-		}
-		else {//Still other players
-			if (game->has_next_turn->fd == fd){//It's this guy's turn!
-				advance_turn(game);
-				remove_player(&(game->head), fd);
-				char buf[150];
-				sprintf(buf, "%s has left the game\r\n", removed_player);
-				broadcast(game, buf);
+			if (game->round_ms == 0){//Turns don't matter in rounds
 				char buffer[150];
 				sprintf(buffer, "It is now %s's turn!\r\n", 
 					    game->has_next_turn->name);
@@ -406,20 +430,15 @@ void safe_remove(struct game_state *game, struct client **new_players, int fd){
 				Write(game->has_next_turn->fd, 
 					  "It is your turn! Please provide a guess\r\n", 
 					  game, new_players);
-				
-			}
-			else {//It's not this guy's turn
-				remove_player(&(game->head), fd);
-				char buf[150];
-				sprintf(buf, "%s has left the game\r\n", removed_player);
-				broadcast(game, buf);
 			}
 		}
+		else {//It's not this guy's turn
+			unlink_player(&(game->head), found);
+			char buf[150];
+			sprintf(buf, "%s has left the game\r\n", removed_player);
+			broadcast(game, buf);
+		}
 	}
-	else{
-		fprintf(stderr, "This is weird...safe_remove\n");
-	}
-	
 }
 //Finds a player in the given linked list of players. Returns the 
 //client struct if found, else NULL
@@ -1,5 +1,13 @@
+#ifndef _GAMEPLAY_H_
+#define _GAMEPLAY_H_
+
 #include <netinet/in.h>
 
+#include "ratelimit.h"
+#include "dict.h"
+#include "deck.h"
+#include "spectate.h"
+
 #define MAX_NAME 30  
 #define MAX_MSG 128
 #define MAX_WORD 20
@@ -8,6 +16,16 @@
 #define NUM_LETTERS 26
 #define WELCOME_MSG "Welcome to our word game. What is your name? "
 
+// Where a client is: entering its name, waiting in the lobby, in a room,
+// or watching one
+#define CLIENT_NEW 0
+#define CLIENT_LOBBY 1
+#define CLIENT_PLAYING 2
+#define CLIENT_WATCHING 3
+
+struct game_state;
+struct word_list;
+
 struct client {
     int fd;	//The integer representing the file descriptor
     struct in_addr ipaddr; //
@@ -15,13 +33,26 @@ struct client {
     char name[MAX_NAME];	//Name of this client
     char inbuf[MAX_BUF];  // Used to hold input from the client
     char *in_ptr;         // A pointer into inbuf to help with partial reads
+    struct conn_limit limit; // Rate limit on input from this client
+    char round_guess;     // Guess made in the open round, or '\0'
+    long long round_guess_at; // When round_guess was made
+    int score;            // Letters revealed this game in round mode
+    int state;            // CLIENT_NEW, CLIENT_LOBBY, CLIENT_PLAYING or
+                          // CLIENT_WATCHING
+    struct game_state *room; // The room this client plays in or watches
+    int bucket;           // Lobby queue, by network latency
+    long long queued_at;  // When this client entered the lobby
+    struct word_list *words; // The word list this client wants to play
+    int watch_slot;       // Where a spectator is in its room's spectators
+    unsigned int frame_seen; // The last frame a spectator was sent
+    unsigned int frame_stalled; // A frame its socket was too busy for
+    long long stalled_since; // 0, or when its socket was first too busy
+    int handshake;        // How far a new client is in admit.h's handshake
+    struct client *admit_next;  // The admission queue, while on it
+    struct client *admit_prev;
 };
 
-// Information about the dictionary used to pick random word
-struct dictionary {
-    FILE *fp;
-    int size;
-};
+struct evil_game;
 
 struct game_state {
     char word[MAX_WORD];      // The word to guess
@@ -29,22 +60,36 @@ struct game_state {
     int letters_guessed[NUM_LETTERS]; // Index i will be 1 if the corresponding
                                       // letter has been guessed; 0 otherwise
     int guesses_left;         // Number of guesses remaining
-    struct dictionary dict;
+    long long move_start;     // When the game, last move or round started
+    const struct dictionary *dict;  // Owned by words
+    struct word_list *words;
+    struct word_deck deck;          // Order the words come up in
+    struct evil_game *evil;   // Candidate words in adversarial mode, or NULL
+
+    // Round mode: everyone guesses within round_ms, then all the guesses
+    // are applied at once. round_ms is 0 when players take turns instead.
+    int round_ms;
+    long long round_end;             // When the open round closes, or 0
+    int round_first[NUM_LETTERS];    // fd of the first to guess each letter
+    char round_order[NUM_LETTERS];   // Distinct letters in arrival order
+    int round_nletters;
     
     struct client *head;
     struct client *has_next_turn;
+    struct room_spectators spectators; // Never take a turn
+
+    int id;                       // Room number shown to players
+    struct game_state *next_room; // Next active room, or next free one
 };
   
-void init_game(struct game_state *game, char *dict_name);
-int get_file_length(char *filename);
+void init_game(struct game_state *game);
 char *status_message(char *msg, struct game_state *game);
 void add_player(struct client **top, int fd, struct in_addr addr);
 void remove_player(struct client **top, int fd);
-int check_name_valid(char *buf, struct game_state state);
+struct client *find_client(int fd);
+int check_name_valid(char *buf);
 void Write(int fd, char *message, struct game_state *game, 
 		   struct client **new_players);
-void add_active_player(struct client **top, int fd, 
-					   struct in_addr addr, char *name);
 int find_network_newline(const char *buf, int n);
 void broadcast(struct game_state *game, char *outbuf);
 void remove_from_new(struct client **top, int fd);
@@ -56,10 +101,12 @@ int make_move(struct game_state *game, char guess, int p_id);
 int valid_guess(struct game_state *game, char guess);
 int find_char_array_length(char *char_array);
 void update_guess_array(struct game_state *game, char guess);
+int apply_guess(struct game_state *game, char guess);
 void handle_move_attempt(struct game_state *game, int move_attempt, int cur_fd,
 					     char guess, char *guesser, struct client *new_players);
 char *status_message(char *msg, struct game_state *game);
 void safe_remove(struct game_state *game, struct client **new_players, int fd);
+void leave_room(struct client *p, struct client **new_players);
 struct client *find_player(struct client *head, int fd);
 struct client *find_previous_player(struct client *head, int fd);
 int linked_list_size(struct client *head);
@@ -68,3 +115,5 @@ void announce_turn(struct game_state *game);
 void announce_winner(struct game_state *game, struct client *winner);
 /* Move the has_next_turn pointer to the next active client */
 void advance_turn(struct game_state *game);
+
+#endif
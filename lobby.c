@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gameplay.h"
+#include "lobby.h"
+#include "room.h"
+#include "clock.h"
+#include "wordlist.h"
+#include "session.h"
+
+// Upper bounds, in microseconds, of the round trip time of each bucket
+// but the last
+static const unsigned int bucket_rtt[LATENCY_BUCKETS - 1] = {
+    5000, 40000, 150000
+};
+
+// One queue per word list and latency bucket
+struct queue {
+    struct client *head;
+    struct client *tail;
+    int count;
+};
+
+static struct queue queues[MAX_WORD_LISTS][LATENCY_BUCKETS];
+// When to try again to open a room for a word list that wouldn't load
+static long long retry_at[MAX_WORD_LISTS];
+static int waiting;
+static int room_size;
+static int max_wait;
+
+void lobby_init(int size, int max_wait_ms) {
+    room_size = size;
+    max_wait = max_wait_ms;
+}
+
+// The kernel's smoothed round trip time estimate for fd decides its bucket
+static int latency_bucket(int fd) {
+    unsigned int rtt = session_rtt(fd);
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && rtt > bucket_rtt[b]) {
+        b++;
+    }
+    return b;
+}
+
+static struct queue *queue_of(struct client *p) {
+    return &queues[p->words->id][p->bucket];
+}
+
+static void append(struct client *p) {
+    struct queue *q = queue_of(p);
+    p->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = p;
+    } else {
+        q->head = p;
+    }
+    q->tail = p;
+    q->count++;
+    waiting++;
+}
+
+static struct client *pop(struct queue *q) {
+    struct client *p = q->head;
+    q->head = p->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    p->next = NULL;
+    q->count--;
+    waiting--;
+    return p;
+}
+
+// Take p out of its queue without freeing it
+static void unlink_client(struct client *p) {
+    struct queue *q = queue_of(p);
+    struct client **c = &q->head;
+    struct client *prev = NULL;
+    while (*c != p) {
+        prev = *c;
+        c = &(*c)->next;
+    }
+    *c = p->next;
+    if (q->tail == p) {
+        q->tail = prev;
+    }
+    p->next = NULL;
+    q->count--;
+    waiting--;
+}
+
+// Queue p, which has chosen its word list, for a room
+void lobby_add(struct client *p) {
+    p->state = CLIENT_LOBBY;
+    p->room = NULL;
+    p->bucket = latency_bucket(p->fd);
+    p->queued_at = now_ms();
+    append(p);
+}
+
+// Move p to the queue for another word list, keeping its place in time
+void lobby_switch(struct client *p, struct word_list *words) {
+    unlink_client(p);
+    p->words = words;
+    append(p);
+}
+
+// Take a waiting player out of the lobby, closing its connection
+void lobby_remove(struct client *p) {
+    unlink_client(p);
+    // remove_player finds p at the head of a list of its own
+    struct client *top = p;
+    remove_player(&top, p->fd);
+}
+
+// Take a waiting player out of the lobby to watch a room
+void lobby_leave(struct client *p) {
+    unlink_client(p);
+}
+
+int lobby_waiting(void) {
+    return waiting;
+}
+
+/* Open a room for words. If the list can't be loaded, tell everyone
+ * waiting for it, and don't try it again for LOBBY_RETRY_MS; they keep
+ * their places meanwhile.
+ */
+static struct game_state *open_room(struct word_list *words, long long now,
+                                    struct client **new_players) {
+    if (now < retry_at[words->id]) {
+        return NULL;
+    }
+    struct game_state *room = room_new(words);
+    if (room != NULL) {
+        return room;
+    }
+    retry_at[words->id] = now + LOBBY_RETRY_MS;
+    char msg[MAX_MSG + MAX_NAME];
+    snprintf(msg, sizeof(msg), "The %s word list can't be loaded right now. "
+             "You will get a room when it can, or type the name of another "
+             "list to switch.\r\n", words->name);
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        struct client *p = queues[words->id][b].head;
+        while (p != NULL) {
+            // Write may remove p if its connection is gone
+            struct client *next = p->next;
+            Write(p->fd, msg, NULL, new_players);
+            p = next;
+        }
+    }
+    return NULL;
+}
+
+/* Place the players waiting for one word list: first every full room
+ * each bucket can make, then anyone who has waited too long. Each player
+ * placed is taken from *budget, and no new room is begun once it has run
+ * out; a room already begun is still started.
+ */
+static void match(struct word_list *words, long long now, int *budget,
+                  struct client **new_players) {
+    struct queue *q = queues[words->id];
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        while (*budget > 0 && q[b].count >= room_size) {
+            struct game_state *room = open_room(words, now, new_players);
+            if (room == NULL) {
+                return;
+            }
+            *budget -= room_size;
+            for (int i = 0; i < room_size; i++) {
+                room_seat(room, pop(&q[b]));
+            }
+            room_start(room, new_players);
+        }
+    }
+
+    struct game_state *partial = NULL;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        while (*budget > 0 && q[b].head != NULL &&
+               now - q[b].head->queued_at >= max_wait) {
+            struct game_state *room = room_with_space(words);
+            if (room != NULL && room != partial) {
+                room_join(room, pop(&q[b]), new_players);
+                (*budget)--;
+                continue;
+            }
+            if (partial == NULL) {
+                partial = open_room(words, now, new_players);
+                if (partial == NULL) {
+                    return;
+                }
+            }
+            room_seat(partial, pop(&q[b]));
+            (*budget)--;
+            if (linked_list_size(partial->head) == room_size) {
+                room_start(partial, new_players);
+                partial = NULL;
+            }
+        }
+    }
+    if (partial != NULL) {
+        room_start(partial, new_players);
+    }
+}
+
+/* Place up to about LOBBY_BATCH waiting players. Each call begins with
+ * the word list after the one the last call began with, so that a busy
+ * list can't keep the others waiting. Returns 1 if the batch ran out
+ * before everyone who could be placed was, 0 otherwise.
+ */
+int lobby_tick(long long now, struct client **new_players) {
+    static int first;
+    if (waiting == 0) {
+        return 0;
+    }
+    int count = word_lists_count();
+    int budget = LOBBY_BATCH;
+    first = (first + 1) % count;
+    for (int i = 0; i < count && budget > 0; i++) {
+        match(word_list_get((first + i) % count), now, &budget, new_players);
+    }
+    return budget <= 0 && waiting > 0;
+}
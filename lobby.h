@@ -0,0 +1,28 @@
+#ifndef _LOBBY_H_
+#define _LOBBY_H_
+
+#include "gameplay.h"
+
+/* Named players wait in the lobby until the matcher, which runs every
+ * tick, places them. Players are queued by the word list they chose and
+ * by network latency, so that rooms are made of players with similar
+ * round trip times who want the same words; each tick turns
+ * every full room's worth of a queue into a new room. Players who have
+ * waited longer than the maximum wait take a free seat in a running room,
+ * or start a room without a full table. A tick places at most about
+ * LOBBY_BATCH players and the loop runs the rest on the following turns,
+ * so a crowded lobby doesn't stall the rooms.
+ */
+#define LATENCY_BUCKETS 4
+#define LOBBY_BATCH 64
+#define LOBBY_RETRY_MS 5000   // Between tries to load a word list that failed
+
+void lobby_init(int room_size, int max_wait_ms);
+void lobby_add(struct client *p);
+void lobby_switch(struct client *p, struct word_list *words);
+void lobby_remove(struct client *p);
+void lobby_leave(struct client *p);
+int lobby_waiting(void);
+int lobby_tick(long long now, struct client **new_players);
+
+#endif
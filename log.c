@@ -0,0 +1,21 @@
+#include <string.h>
+
+#include "log.h"
+
+int log_level = LOG_DEBUG;
+
+static const char *names[] = {"quiet", "info", "debug"};
+
+const char *log_level_name(int level) {
+    return names[level];
+}
+
+// Return the level called name, or -1 if there is none
+int log_level_parse(const char *name) {
+    for (int i = LOG_QUIET; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
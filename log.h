@@ -0,0 +1,34 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdio.h>
+
+/* How much the server writes to stdout while running. Errors always go
+ * to stderr, and startup messages are always printed.
+ *   - quiet: nothing else
+ *   - info: connections, rooms opening and closing, word lists loading
+ *   - debug: every move and message too (the default)
+ */
+#define LOG_QUIET 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+extern int log_level;
+
+const char *log_level_name(int level);
+int log_level_parse(const char *name);
+
+#define log_info(...) \
+    do { \
+        if (log_level >= LOG_INFO) { \
+            printf(__VA_ARGS__); \
+        } \
+    } while (0)
+#define log_debug(...) \
+    do { \
+        if (log_level >= LOG_DEBUG) { \
+            printf(__VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+#include "metrics.h"
+
+struct server_metrics metrics;
+
+void print_metrics(FILE *out) {
+    fprintf(out, "connections %lu\n", metrics.connections);
+    fprintf(out, "connections_refused %lu\n", metrics.connections_refused);
+    fprintf(out, "chunks_in %lu\n", metrics.chunks_in);
+    fprintf(out, "bytes_in %lu\n", metrics.bytes_in);
+    fprintf(out, "bytes_out %lu\n", metrics.bytes_out);
+    fprintf(out, "dropped_conn_rate %lu\n", metrics.dropped_conn_rate);
+    fprintf(out, "dropped_ip_rate %lu\n", metrics.dropped_ip_rate);
+    fprintf(out, "dropped_overflow %lu\n", metrics.dropped_overflow);
+    fprintf(out, "flood_disconnects %lu\n", metrics.flood_disconnects);
+    fprintf(out, "addresses_banned %lu\n", metrics.addresses_banned);
+    fprintf(out, "frames_sent %lu\n", metrics.frames_sent);
+    fprintf(out, "frames_skipped %lu\n", metrics.frames_skipped);
+    fprintf(out, "frames_stalled %lu\n", metrics.frames_stalled);
+    fprintf(out, "turns %lu\n", metrics.turns);
+    fprintf(out, "syscalls %lu\n", metrics.syscalls);
+    fflush(out);
+}
@@ -0,0 +1,29 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+
+/* Server-wide counters. Dumped to stdout when the server gets SIGUSR1. */
+struct server_metrics {
+    unsigned long connections;          // accepted and kept
+    unsigned long connections_refused;  // address over its limit or banned
+    unsigned long chunks_in;            // successful reads from clients
+    unsigned long bytes_in;
+    unsigned long bytes_out;            // sent or queued to clients
+    unsigned long dropped_conn_rate;    // reads dropped, connection limit
+    unsigned long dropped_ip_rate;      // reads dropped, address limit
+    unsigned long dropped_overflow;     // input that never had a newline
+    unsigned long flood_disconnects;
+    unsigned long addresses_banned;
+    unsigned long frames_sent;          // to spectators
+    unsigned long frames_skipped;       // replaced before they were sent
+    unsigned long frames_stalled;       // held back from busy spectators
+    unsigned long turns;                // of the event loop
+    unsigned long syscalls;             // the loop made for network I/O
+};
+
+extern struct server_metrics metrics;
+
+void print_metrics(FILE *out);
+
+#endif
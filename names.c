@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+
+#define NAME_BUCKETS 4096   // must be a power of two
+
+struct name_entry {
+    struct name_entry *next;
+    char name[];
+};
+
+static struct name_entry *buckets[NAME_BUCKETS];
+
+static unsigned int hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h & (NAME_BUCKETS - 1);
+}
+
+int name_taken(const char *name) {
+    for (struct name_entry *e = buckets[hash(name)]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void name_add(const char *name) {
+    struct name_entry *e = malloc(sizeof(struct name_entry) + strlen(name) + 1);
+    if (e == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    strcpy(e->name, name);
+    e->next = buckets[hash(name)];
+    buckets[hash(name)] = e;
+}
+
+void name_remove(const char *name) {
+    struct name_entry **e;
+    for (e = &buckets[hash(name)]; *e != NULL; e = &(*e)->next) {
+        if (strcmp((*e)->name, name) == 0) {
+            struct name_entry *t = *e;
+            *e = t->next;
+            free(t);
+            return;
+        }
+    }
+}
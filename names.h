@@ -0,0 +1,11 @@
+#ifndef _NAMES_H_
+#define _NAMES_H_
+
+/* The names of every named player on the server, in the lobby or in a
+ * room, so a new name can be checked without walking every room.
+ */
+int name_taken(const char *name);
+void name_add(const char *name);
+void name_remove(const char *name);
+
+#endif
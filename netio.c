@@ -0,0 +1,841 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "netio.h"
+#include "metrics.h"
+#include "session.h"
+
+#ifdef USE_IO_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* The set of socket descriptors for select to monitor, and how far into
+ * the set to search. The io_uring backend keeps allset up to date as well
+ * so that netio_maxfd means the same thing for both.
+ */
+static fd_set allset;
+static int maxfd = -1;
+static int use_uring = 0;
+static int use_null = 0;
+
+#ifdef USE_IO_URING
+
+#define RING_ENTRIES 256
+#define CQ_ENTRIES 4096
+
+/* Input is received into a ring of BUF_COUNT provided buffers that the
+ * kernel picks from, and copied out to the descriptor's own queue when
+ * the completion is reaped, so each buffer goes straight back to the ring.
+ * A descriptor stops receiving while RX_MAX bytes (or ACCEPT_MAX accepted
+ * connections) wait to be read, as a full socket buffer would stop it.
+ */
+#define BUF_GROUP 0
+#define BUF_COUNT 512
+#define BUF_SIZE 256
+#define RX_MAX 4096
+#define ACCEPT_MAX 64
+
+// What a completion belongs to, kept in the top byte of user_data
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_CANCEL 3
+#define OP_ACCEPT 4
+#define OP_DRAIN 5
+
+#define GEN_MASK 0xffffff
+
+struct outbuf {
+    char *data;
+    int len;
+    int cap;
+};
+
+/* Per descriptor state. gen changes whenever the descriptor is added or
+ * removed, so completions for a socket that has been closed (and whose
+ * number may already be reused) can be recognised and ignored.
+ */
+struct uring_fd {
+    unsigned gen;
+    int watched;
+    int listening;           // accepts connections instead of reading
+    int recv_armed;          // a multishot RECV/ACCEPT is in the kernel
+    int stopping;            // and has been cancelled
+    int rx_eof;              // the peer closed its end
+    int rx_errno;            // why input stopped, if it failed
+    struct outbuf rx;        // received, not read yet (accepted
+                             // descriptors, as ints, for a listener)
+    int send_busy;           // inflight is owned by the kernel
+    int sent;                // bytes of inflight already sent
+    struct outbuf pending;   // queued, not submitted yet
+    struct outbuf inflight;  // submitted, kept until its completion
+};
+
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail;       // our tail, published to the kernel on enter
+    unsigned queued;         // entries not submitted yet
+} ring;
+
+static struct uring_fd fds[FD_SETSIZE];
+static int drained;          // netio_close's cancel has completed
+
+// The provided buffers and the ring that hands them to the kernel
+static struct io_uring_buf_ring *buf_ring;
+static char *buffers;
+static unsigned short buf_tail;
+
+/* Descriptors that need a receive armed or have output waiting, so that
+ * netio_wait only looks at descriptors that changed this turn.
+ */
+static int dirty[FD_SETSIZE];
+static char is_dirty[FD_SETSIZE];
+static int ndirty;
+
+/* Descriptors that may have input queued. Like select, netio_wait reports
+ * them every turn until everything has been read.
+ */
+static int inputs[FD_SETSIZE];
+static char is_input[FD_SETSIZE];
+static int ninputs;
+
+static unsigned long long make_data(int op, unsigned gen, int fd) {
+    return ((unsigned long long)op << 56) |
+           ((unsigned long long)(gen & GEN_MASK) << 32) | (unsigned)fd;
+}
+
+static void mark_dirty(int fd) {
+    if (!is_dirty[fd]) {
+        is_dirty[fd] = 1;
+        dirty[ndirty++] = fd;
+    }
+}
+
+static void mark_input(int fd) {
+    if (!is_input[fd]) {
+        is_input[fd] = 1;
+        inputs[ninputs++] = fd;
+    }
+}
+
+static int has_input(struct uring_fd *f) {
+    return f->watched && (f->rx.len > 0 || f->rx_eof || f->rx_errno);
+}
+
+/* Hand every queued entry to the kernel, optionally waiting for at least
+ * min_complete completions. Returns what io_uring_enter returned.
+ */
+static int ring_enter(unsigned min_complete, struct timeval *timeout) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    __atomic_store_n(ring.sq_tail, ring.sqe_tail, __ATOMIC_RELEASE);
+    if (min_complete > 0) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        memset(&arg, 0, sizeof(arg));
+        if (timeout != NULL) {
+            ts.tv_sec = timeout->tv_sec;
+            ts.tv_nsec = timeout->tv_usec * 1000;
+            arg.ts = (unsigned long long)(uintptr_t)&ts;
+        }
+        argp = &arg;
+        argsz = sizeof(arg);
+    } else if (ring.queued == 0) {
+        return 0;
+    }
+    int ret = syscall(__NR_io_uring_enter, ring.fd, ring.queued,
+                      min_complete, flags, argp, argsz);
+    metrics.syscalls++;
+    if (ret > 0) {
+        ring.queued -= ret;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe(void) {
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    if (ring.sqe_tail - head >= ring.sq_entries) {
+        // Ring is full; push what we have so far to the kernel
+        if (ring_enter(0, NULL) < 0) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+    }
+    unsigned idx = ring.sqe_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[idx] = idx;
+    ring.sqe_tail++;
+    ring.queued++;
+    return sqe;
+}
+
+/* Arm a multishot receive (or accept, on a listening socket): it keeps
+ * completing, without being submitted again, until it's cancelled, the
+ * peer closes, or it runs out of buffers.
+ */
+static void arm_recv(int fd) {
+    struct uring_fd *f = &fds[fd];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->fd = fd;
+    if (f->listening) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = make_data(OP_ACCEPT, f->gen, fd);
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        sqe->user_data = make_data(OP_RECV, f->gen, fd);
+    }
+    f->recv_armed = 1;
+    f->stopping = 0;
+}
+
+// Whether fd should be receiving: armed, or re-armed at the next wait
+static int want_recv(struct uring_fd *f) {
+    int limit = f->listening ? ACCEPT_MAX * (int)sizeof(int) : RX_MAX;
+    return f->watched && !f->rx_eof && !f->rx_errno && f->rx.len < limit;
+}
+
+// Give buffer bid back to the kernel
+static void recycle(int bid) {
+    struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (BUF_COUNT - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)(buffers + bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    buf_tail++;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+static int append(struct outbuf *out, const void *buf, int len) {
+    if (out->len + len > out->cap) {
+        int cap = out->cap ? out->cap : 512;
+        while (cap < out->len + len) {
+            cap *= 2;
+        }
+        char *data = realloc(out->data, cap);
+        if (data == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, buf, len);
+    out->len += len;
+    return 0;
+}
+
+static void submit_send(int fd) {
+    struct uring_fd *f = &fds[fd];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)(f->inflight.data + f->sent);
+    sqe->len = f->inflight.len - f->sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = make_data(OP_SEND, f->gen, fd);
+    f->send_busy = 1;
+}
+
+static void cancel(int op, int fd) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = make_data(op, fds[fd].gen, fd);
+    sqe->user_data = make_data(OP_CANCEL, fds[fd].gen, fd);
+}
+
+static void start_send(int fd) {
+    struct uring_fd *f = &fds[fd];
+    struct outbuf tmp = f->inflight;
+    f->inflight = f->pending;
+    f->pending = tmp;
+    f->pending.len = 0;
+    f->sent = 0;
+    submit_send(fd);
+}
+
+static void send_done(int fd, unsigned gen, int res) {
+    struct uring_fd *f = &fds[fd];
+    f->send_busy = 0;
+    if (gen != (f->gen & GEN_MASK) || res <= 0) {
+        // Closed in the meantime, or the peer is gone. A broken socket
+        // is reported through its receive, so only drop the bytes here.
+        f->inflight.len = 0;
+        if (gen == (f->gen & GEN_MASK)) {
+            f->pending.len = 0;
+        }
+    } else if (f->sent + res < f->inflight.len) {
+        f->sent += res;
+        submit_send(fd);
+        return;
+    } else {
+        f->inflight.len = 0;
+    }
+    if (f->pending.len > 0) {
+        mark_dirty(fd);
+    }
+}
+
+/* A receive (or accept) completed with res. Input is queued for
+ * netio_read or netio_accept; the receive is re-armed at the next wait if
+ * it has stopped.
+ */
+static void recv_done(int op, int fd, unsigned gen, struct io_uring_cqe *cqe) {
+    struct uring_fd *f = &fds[fd];
+    int current = gen == (f->gen & GEN_MASK);
+    int res = cqe->res;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (current && res > 0) {
+            append(&f->rx, buffers + bid * BUF_SIZE, res);
+        }
+        recycle(bid);
+    } else if (op == OP_ACCEPT && res >= 0) {
+        if (!current || append(&f->rx, &res, sizeof(res)) == -1) {
+            metrics.syscalls++;
+            close(res);
+        }
+    }
+    if (!current) {
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        f->recv_armed = 0;
+        if (res == -EINVAL) {
+            fprintf(stderr, "io_uring can't do multishot %s here (needs "
+                    "Linux 6.0)\n", op == OP_ACCEPT ? "accepts" : "receives");
+            exit(1);
+        }
+        if (res == 0 && op == OP_RECV) {
+            f->rx_eof = 1;
+        } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+            f->rx_errno = -res;
+        }
+        mark_dirty(fd);
+    } else if (!f->stopping && !want_recv(f)) {
+        // Enough is queued; stop until some of it has been read
+        cancel(op, fd);
+        f->stopping = 1;
+    }
+    if (has_input(f)) {
+        mark_input(fd);
+    }
+}
+
+// Process every completion in the ring
+static void reap(void) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        int op = cqe->user_data >> 56;
+        unsigned gen = (cqe->user_data >> 32) & GEN_MASK;
+        int fd = (int)(cqe->user_data & 0xffffffff);
+
+        if (op == OP_SEND) {
+            send_done(fd, gen, cqe->res);
+        } else if (op == OP_RECV || op == OP_ACCEPT) {
+            recv_done(op, fd, gen, cqe);
+        } else if (op == OP_DRAIN) {
+            drained = 1;
+        }
+        head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Mark every descriptor with input queued as ready, returning how many
+static int collect(fd_set *ready) {
+    int nready = 0;
+    int kept = 0;
+    for (int i = 0; i < ninputs; i++) {
+        int fd = inputs[i];
+        if (has_input(&fds[fd])) {
+            inputs[kept++] = fd;
+            FD_SET(fd, ready);
+            nready++;
+        } else {
+            is_input[fd] = 0;
+        }
+    }
+    ninputs = kept;
+    return nready;
+}
+
+static int uring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = CQ_ENTRIES;
+
+    int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes +
+                     p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    char *rings = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        munmap(rings, size);
+        close(fd);
+        return -1;
+    }
+
+    ring.fd = fd;
+    ring.sq_head = (unsigned *)(rings + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(rings + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(rings + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.cq_head = (unsigned *)(rings + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(rings + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+    ring.sqe_tail = *ring.sq_tail;
+    ring.queued = 0;
+
+    // The provided buffers, all handed to the kernel to start with
+    buf_ring = mmap(NULL, BUF_COUNT * sizeof(struct io_uring_buf),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    buffers = mmap(NULL, BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (buf_ring == MAP_FAILED || buffers == MAP_FAILED) {
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    buf_tail = 0;
+    for (int bid = 0; bid < BUF_COUNT; bid++) {
+        recycle(bid);
+    }
+    return 0;
+}
+
+static int uring_wait(fd_set *ready, struct timeval *timeout) {
+    FD_ZERO(ready);
+    reap();
+
+    // Queue this turn's re-arms and sends; they go to the kernel in the
+    // same io_uring_enter that waits for the next event.
+    for (int i = 0; i < ndirty; i++) {
+        int fd = dirty[i];
+        struct uring_fd *f = &fds[fd];
+        is_dirty[fd] = 0;
+        if (!f->watched) {
+            continue;
+        }
+        if (!f->recv_armed && want_recv(f)) {
+            arm_recv(fd);
+        }
+        if (f->pending.len > 0 && !f->send_busy) {
+            start_send(fd);
+        }
+    }
+    ndirty = 0;
+
+    // Input that is already queued doesn't wait
+    int nready = collect(ready);
+    if (nready > 0) {
+        if (ring_enter(0, NULL) < 0) {
+            return -1;
+        }
+        return nready;
+    }
+    if (ring_enter(1, timeout) < 0 && errno != ETIME) {
+        if (errno == EINTR) {
+            reap();
+            nready = collect(ready);
+            return nready > 0 ? nready : -1;
+        }
+        return -1;
+    }
+    reap();
+    return collect(ready);
+}
+
+// Whether fd has queued or submitted bytes the kernel hasn't finished
+static int uring_busy(int fd) {
+    return fds[fd].pending.len > 0 || fds[fd].send_busy;
+}
+
+static int uring_send(int fd, const char *buf, int len) {
+    struct uring_fd *f = &fds[fd];
+    if (!f->watched || append(&f->pending, buf, len) == -1) {
+        return -1;
+    }
+    mark_dirty(fd);
+    return len;
+}
+
+static int uring_read(int fd, char *buf, int n) {
+    struct uring_fd *f = &fds[fd];
+    if (f->rx.len > 0) {
+        if (n > f->rx.len) {
+            n = f->rx.len;
+        }
+        memcpy(buf, f->rx.data, n);
+        f->rx.len -= n;
+        memmove(f->rx.data, f->rx.data + n, f->rx.len);
+        // There may be room to receive again
+        mark_dirty(fd);
+        return n;
+    }
+    if (f->rx_errno != 0) {
+        errno = f->rx_errno;
+        return -1;
+    }
+    if (f->rx_eof) {
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static int uring_accept(int fd) {
+    struct uring_fd *f = &fds[fd];
+    int conn;
+    if (f->rx.len > 0) {
+        memcpy(&conn, f->rx.data, sizeof(conn));
+        f->rx.len -= sizeof(conn);
+        memmove(f->rx.data, f->rx.data + sizeof(conn), f->rx.len);
+        mark_dirty(fd);
+        return conn;
+    }
+    // A failed accept is reported once, and then accepting starts again
+    errno = f->rx_errno ? f->rx_errno : EAGAIN;
+    f->rx_errno = 0;
+    mark_dirty(fd);
+    return -1;
+}
+
+#endif /* USE_IO_URING */
+
+void netio_init(const char *name) {
+    FD_ZERO(&allset);
+    maxfd = -1;
+    if (name != NULL && strcmp(name, "null") == 0) {
+        use_null = 1;
+        return;
+    }
+    if (name != NULL && strcmp(name, "select") == 0) {
+        return;
+    }
+    if (name != NULL && strcmp(name, "io_uring") != 0) {
+        fprintf(stderr, "Unknown I/O backend %s; using select\n", name);
+        return;
+    }
+#ifdef USE_IO_URING
+    if (uring_setup() == 0) {
+        use_uring = 1;
+        return;
+    }
+    perror("io_uring_setup; using select");
+#else
+    if (name != NULL) {
+        fprintf(stderr, "Built without io_uring support; using select\n");
+    }
+#endif
+}
+
+const char *netio_backend(void) {
+    if (use_null) {
+        return "null";
+    }
+    return use_uring ? "io_uring" : "select";
+}
+
+static int watch(int fd, int listening) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        fprintf(stderr, "Cannot watch fd %d\n", fd);
+        return -1;
+    }
+    FD_SET(fd, &allset);
+    if (fd > maxfd) {
+        maxfd = fd;
+    }
+#ifdef USE_IO_URING
+    if (use_uring) {
+        struct uring_fd *f = &fds[fd];
+        f->gen++;
+        f->watched = 1;
+        f->listening = listening;
+        f->recv_armed = 0;
+        f->stopping = 0;
+        f->rx_eof = 0;
+        f->rx_errno = 0;
+        f->rx.len = 0;
+        f->pending.len = 0;
+        mark_dirty(fd);
+    }
+#endif
+    return 0;
+}
+
+int netio_add(int fd) {
+    return watch(fd, 0);
+}
+
+int netio_listen(int fd) {
+    return watch(fd, 1);
+}
+
+void netio_remove(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    FD_CLR(fd, &allset);
+#ifdef USE_IO_URING
+    if (use_uring && fds[fd].watched) {
+        struct uring_fd *f = &fds[fd];
+        if (f->recv_armed && !f->stopping) {
+            cancel(f->listening ? OP_ACCEPT : OP_RECV, fd);
+        }
+        if (f->send_busy) {
+            cancel(OP_SEND, fd);
+        }
+        // Connections accepted but never taken are closed with it
+        for (int i = 0; f->listening && i < f->rx.len / (int)sizeof(int);
+             i++) {
+            metrics.syscalls++;
+            close(((int *)f->rx.data)[i]);
+        }
+        f->gen++;
+        f->watched = 0;
+        f->recv_armed = 0;
+        f->rx.len = 0;
+        f->pending.len = 0;
+    }
+#endif
+}
+
+int netio_read(int fd, char *buf, int n) {
+#ifdef USE_IO_URING
+    if (use_uring) {
+        return uring_read(fd, buf, n);
+    }
+#endif
+    metrics.syscalls++;
+    return read(fd, buf, n);
+}
+
+int netio_accept(int fd, struct sockaddr *addr, socklen_t *len) {
+#ifdef USE_IO_URING
+    if (use_uring) {
+        int conn = uring_accept(fd);
+        if (conn == -1 || addr == NULL) {
+            return conn;
+        }
+        // A multishot accept has nowhere to put each peer's address
+        metrics.syscalls++;
+        if (getpeername(conn, addr, len) == -1) {
+            metrics.syscalls++;
+            close(conn);
+            errno = ECONNABORTED;
+            return -1;
+        }
+        return conn;
+    }
+#endif
+    metrics.syscalls++;
+    return accept(fd, addr, len);
+}
+
+int netio_pending(int fd) {
+#ifdef USE_IO_URING
+    if (use_uring) {
+        return fds[fd].watched && fds[fd].rx.len > 0;
+    }
+#endif
+    return 0;
+}
+
+void netio_close(void) {
+#ifdef USE_IO_URING
+    if (use_uring) {
+        /* Requests in the kernel hold their sockets, the listening one
+         * too, until the ring is torn down, which happens some time after
+         * the server exits. Cancel them so the port is free at once.
+         */
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = make_data(OP_DRAIN, 0, 0);
+        while (!drained && (ring_enter(1, NULL) >= 0 || errno == EINTR)) {
+            reap();
+        }
+        close(ring.fd);
+        use_uring = 0;
+    }
+#endif
+}
+
+int netio_maxfd(void) {
+    return maxfd;
+}
+
+int netio_wait(fd_set *ready, struct timeval *timeout) {
+    if (use_null) {
+        FD_ZERO(ready);
+        return 0;
+    }
+#ifdef USE_IO_URING
+    if (use_uring) {
+        return uring_wait(ready, timeout);
+    }
+#endif
+    *ready = allset;
+    metrics.syscalls++;
+    return select(maxfd + 1, ready, NULL, NULL, timeout);
+}
+
+/* Send buf with one nonblocking write if the socket has sent everything
+ * it was given before. Returns len, 0 if the socket still holds unsent
+ * bytes, or -1 on an error or if only part of buf fit.
+ */
+static int try_write(int fd, const char *buf, int len) {
+    int unsent;
+    metrics.syscalls++;
+    if (ioctl(fd, SIOCOUTQNSD, &unsent) == -1) {
+        return -1;
+    }
+    if (unsent > 0) {
+        return 0;
+    }
+    metrics.syscalls++;
+    int sent = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    return sent == len ? len : -1;
+}
+
+int netio_try_send(int fd, const char *buf, int len) {
+    int sent;
+    if (use_null) {
+        return session_try_send(fd, len);
+    }
+#ifdef USE_IO_URING
+    if (use_uring && uring_busy(fd)) {
+        // Writing now would jump ahead of what is queued
+        sent = 0;
+    } else
+#endif
+    sent = try_write(fd, buf, len);
+    if (sent == -1) {
+        session_send_failed(fd);
+    } else if (sent == 0) {
+        session_send_stalled(fd);
+    } else {
+        metrics.bytes_out += sent;
+    }
+    return sent;
+}
+
+#ifdef USE_IO_URING
+// Write what is queued for fd and then buf, without waiting
+static int uring_send_now(int fd, const char *buf, int len) {
+    struct uring_fd *f = &fds[fd];
+    if (!f->watched) {
+        return -1;
+    }
+    // Bytes already submitted went out when the kernel took the send,
+    // unless the socket was full, and then this can't be written anyway
+    if (f->pending.len > 0) {
+        metrics.syscalls++;
+        int sent = send(fd, f->pending.data, f->pending.len,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+        int whole = sent == f->pending.len;
+        f->pending.len = 0;
+        if (!whole) {
+            return -1;
+        }
+    }
+    metrics.syscalls++;
+    return send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) == len ? len : -1;
+}
+#endif
+
+int netio_send_now(int fd, const char *buf, int len) {
+#ifdef USE_IO_URING
+    if (use_uring) {
+        int sent = uring_send_now(fd, buf, len);
+        if (sent == -1) {
+            session_send_failed(fd);
+        } else {
+            metrics.bytes_out += sent;
+        }
+        return sent;
+    }
+#endif
+    // The other backends already send everything before returning
+    return netio_send(fd, buf, len);
+}
+
+int netio_send(int fd, const char *buf, int len) {
+    int sent;
+    if (use_null) {
+        sent = session_send(fd, len);
+    }
+#ifdef USE_IO_URING
+    else if (use_uring) {
+        sent = uring_send(fd, buf, len);
+    }
+#endif
+    else {
+        metrics.syscalls++;
+        sent = write(fd, buf, len);
+    }
+    if (sent == -1) {
+        session_send_failed(fd);
+    } else {
+        metrics.bytes_out += sent;
+    }
+    return sent;
+}
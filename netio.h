@@ -0,0 +1,80 @@
+#ifndef _NETIO_H_
+#define _NETIO_H_
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* The server's socket I/O goes through one of two backends:
+ *   - select: one select() per loop turn, and one read(), write() or
+ *     accept() per message or connection.
+ *   - io_uring (only when built with IO_URING=1, and Linux 6.0+): every
+ *     socket has a multishot receive (or accept) in the kernel that fills
+ *     buffers from a provided-buffer ring, and outgoing messages are queued
+ *     and handed to the kernel together with the wait. Reads and accepts
+ *     take what has already been received, so a loop turn costs one
+ *     io_uring_enter no matter how many clients it reads or writes.
+ * A third backend, null, is used to replay recorded sessions: it never
+ * waits, and its sends go nowhere.
+ */
+
+/* Pick a backend by name ("select", "io_uring" or "null"), or the best available
+ * one if name is NULL. Falls back to select if io_uring cannot be used.
+ */
+void netio_init(const char *name);
+const char *netio_backend(void);
+
+/* Start/stop watching fd for input: a connected socket with netio_add,
+ * read with netio_read, or a listening one with netio_listen, accepted
+ * from with netio_accept. netio_remove must be called before the
+ * descriptor is closed. Returns -1 if fd is out of range.
+ */
+int netio_add(int fd);
+int netio_listen(int fd);
+void netio_remove(int fd);
+
+/* read(2) and accept(2) for a watched socket that netio_wait reported
+ * ready. io_uring takes the bytes or connection it has already received;
+ * it fails with EAGAIN if it has none.
+ */
+int netio_read(int fd, char *buf, int n);
+int netio_accept(int fd, struct sockaddr *addr, socklen_t *len);
+
+/* Whether netio_read or netio_accept on fd has more to return without
+ * waiting (only io_uring knows; select says no)
+ */
+int netio_pending(int fd);
+int netio_maxfd(void);
+
+// Stop all I/O, before the server exits
+void netio_close(void);
+
+/* Wait until at least one watched descriptor is readable or the timeout
+ * expires (NULL waits forever). Fills ready like select does and returns
+ * the number of ready descriptors, 0 on timeout (io_uring may also return
+ * 0 early after finishing queued sends) or -1 on error.
+ */
+int netio_wait(fd_set *ready, struct timeval *timeout);
+
+/* Send len bytes to fd. The select backend writes immediately; io_uring
+ * queues the bytes and sends them in order at the next netio_wait.
+ * Returns len, or -1 if the message could not be written or queued.
+ */
+int netio_send(int fd, const char *buf, int len);
+
+/* Send len bytes to fd only if that can be done without waiting: the
+ * socket must have sent on everything it was given before and have room
+ * for all of buf. For clients that may not be reading, like spectators.
+ * Returns len, 0 if fd is still busy and nothing was sent, or -1 if the
+ * message could not be written.
+ */
+int netio_try_send(int fd, const char *buf, int len);
+
+/* Send len bytes to fd before returning, after anything still queued for
+ * it. For a last message to a client that is about to be removed, since
+ * netio_remove drops what io_uring has queued. Returns len, or -1 if the
+ * message could not be written.
+ */
+int netio_send_now(int fd, const char *buf, int len);
+
+#endif
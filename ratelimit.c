@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "ratelimit.h"
+#include "clock.h"
+#include "metrics.h"
+
+#define IP_TABLE_SIZE 4096  // must be a power of two
+#define IP_PROBE 8
+
+/* Limits shared by every connection from one address. The table is a
+ * fixed size open addressing hash; when a probe sequence is full the
+ * least recently seen address in it is forgotten.
+ */
+struct ip_limit {
+    in_addr_t addr;
+    int used;
+    struct token_bucket bucket;
+    int offences;
+    long long banned_until;
+    long long last_seen;
+};
+
+static struct ip_limit ip_table[IP_TABLE_SIZE];
+static int ip_rate = IP_RATE;
+static int ip_burst = IP_BURST;
+
+// Allow each address ip_rate reads and connections a second
+void ratelimit_init(int rate) {
+    ip_rate = rate;
+    ip_burst = 2 * rate;
+}
+
+static void bucket_init(struct token_bucket *bucket, int burst,
+                        long long now) {
+    bucket->tokens = burst * 1000LL;
+    bucket->last = now;
+}
+
+// Refill the bucket for the time since it was last used, then take a token.
+// Return 1 if there was one, 0 if the bucket is empty.
+static int take_token(struct token_bucket *bucket, int rate, int burst,
+                      long long now) {
+    bucket->tokens += (now - bucket->last) * rate;
+    bucket->last = now;
+    if (bucket->tokens > burst * 1000LL) {
+        bucket->tokens = burst * 1000LL;
+    }
+    if (bucket->tokens < 1000) {
+        return 0;
+    }
+    bucket->tokens -= 1000;
+    return 1;
+}
+
+static struct ip_limit *find_ip(in_addr_t addr, long long now) {
+    unsigned int hash = ((unsigned int)addr * 2654435761u) >> 20;
+    struct ip_limit *victim = NULL;
+
+    for (int i = 0; i < IP_PROBE; i++) {
+        struct ip_limit *entry = &ip_table[(hash + i) & (IP_TABLE_SIZE - 1)];
+        if (entry->used && entry->addr == addr) {
+            entry->last_seen = now;
+            return entry;
+        }
+        if (!entry->used) {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || entry->last_seen < victim->last_seen) {
+            victim = entry;
+        }
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->used = 1;
+    victim->addr = addr;
+    victim->last_seen = now;
+    bucket_init(&victim->bucket, ip_burst, now);
+    return victim;
+}
+
+void conn_limit_init(struct conn_limit *limit) {
+    long long now = now_ms();
+    bucket_init(&limit->bucket, CONN_BURST, now);
+    limit->strikes = 0;
+    limit->strike_start = now;
+}
+
+// Decide whether to take a new connection from addr; 0 if so, 1 to refuse
+int ratelimit_accept(struct in_addr addr) {
+    long long now = now_ms();
+    struct ip_limit *ip = find_ip(addr.s_addr, now);
+    if (ip->banned_until > now || !take_token(&ip->bucket, ip_rate, ip_burst,
+                                              now)) {
+        metrics.connections_refused++;
+        return 1;
+    }
+    return 0;
+}
+
+// Charge one read from a client against its own and its address's limits.
+// This is done before the input is parsed, so a flood costs one read and
+// a couple of comparisons per chunk rather than a move and its replies.
+int ratelimit_input(struct conn_limit *limit, struct in_addr addr) {
+    long long now = now_ms();
+    struct ip_limit *ip = find_ip(addr.s_addr, now);
+
+    if (!take_token(&limit->bucket, CONN_RATE, CONN_BURST, now)) {
+        metrics.dropped_conn_rate++;
+    } else if (!take_token(&ip->bucket, ip_rate, ip_burst, now)) {
+        metrics.dropped_ip_rate++;
+    } else {
+        return RATE_OK;
+    }
+
+    if (now - limit->strike_start > STRIKE_WINDOW) {
+        limit->strike_start = now;
+        limit->strikes = 0;
+    }
+    limit->strikes++;
+    if (limit->strikes > MAX_STRIKES) {
+        metrics.flood_disconnects++;
+        ip->offences++;
+        if (ip->offences >= MAX_OFFENCES) {
+            fprintf(stderr, "Refusing %s for flooding\n", inet_ntoa(addr));
+            ip->banned_until = now + BAN_TIME;
+            ip->offences = 0;
+            metrics.addresses_banned++;
+        }
+        return RATE_DISCONNECT;
+    }
+    return limit->strikes == 1 ? RATE_WARN : RATE_DROP;
+}
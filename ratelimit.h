@@ -0,0 +1,43 @@
+#ifndef _RATELIMIT_H_
+#define _RATELIMIT_H_
+
+#include <netinet/in.h>
+
+// Reads per second one connection may send, and how many may come at once
+#define CONN_RATE 4
+#define CONN_BURST 8
+// The same for all connections from one address, new connections included,
+// unless ratelimit_init sets another rate (the burst is twice the rate)
+#define IP_RATE 16
+#define IP_BURST 32
+// Dropped reads within STRIKE_WINDOW ms before the client is disconnected
+#define MAX_STRIKES 20
+#define STRIKE_WINDOW 10000
+// Flood disconnects before the address is refused for BAN_TIME ms
+#define MAX_OFFENCES 3
+#define BAN_TIME 60000
+
+// What ratelimit_input decided about a read
+#define RATE_OK 0
+#define RATE_DROP 1       // drop the input silently
+#define RATE_WARN 2       // drop the input and tell the client to slow down
+#define RATE_DISCONNECT 3 // the client keeps flooding; remove it
+
+// Tokens are kept in thousandths so the refill needs no floating point
+struct token_bucket {
+    long long tokens;
+    long long last;
+};
+
+struct conn_limit {
+    struct token_bucket bucket;
+    int strikes;
+    long long strike_start;
+};
+
+void ratelimit_init(int ip_rate);
+void conn_limit_init(struct conn_limit *limit);
+int ratelimit_accept(struct in_addr addr);
+int ratelimit_input(struct conn_limit *limit, struct in_addr addr);
+
+#endif
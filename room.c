@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "room.h"
+#include "round.h"
+#include "evil.h"
+#include "wordlist.h"
+#include "log.h"
+
+static struct room_config config;
+static struct game_state *active_rooms;   // Rooms with games going on
+static struct game_state *free_rooms;     // Pool of rooms to reuse
+static int nactive;
+static int last_id;
+
+void rooms_init(const struct room_config *room_config) {
+    config = *room_config;
+}
+
+/* Take a room from the pool (or make one) and start a game in it with a
+ * word from words. The room has no players yet. Returns NULL if the word
+ * list can't be loaded.
+ */
+struct game_state *room_new(struct word_list *words) {
+    if (word_list_acquire(words) != 0) {
+        return NULL;
+    }
+    struct game_state *room = free_rooms;
+    if (room != NULL) {
+        free_rooms = room->next_room;
+    } else {
+        room = calloc(1, sizeof(struct game_state));
+        if (room == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    room->id = ++last_id;
+    room->words = words;
+    room->dict = &words->dict;
+    deck_init(&room->deck, words->dict.size, config.seed ^ room->id);
+    // The candidate set is sized for the word list
+    room->evil = NULL;
+    if (words->evil_index != NULL) {
+        room->evil = evil_game_new(words->evil_index);
+    }
+    room->round_ms = config.round_ms;
+    room->round_end = 0;
+    room->head = NULL;
+    room->has_next_turn = NULL;
+    init_game(room);
+
+    room->next_room = active_rooms;
+    active_rooms = room;
+    nactive++;
+    log_info("Room %d opened with word list %s\n", room->id, words->name);
+    return room;
+}
+
+// Put p at the end of room's turn order
+void room_seat(struct game_state *room, struct client *p) {
+    struct client **last = &room->head;
+    while (*last != NULL) {
+        last = &(*last)->next;
+    }
+    p->next = NULL;
+    *last = p;
+    p->state = CLIENT_PLAYING;
+    p->room = room;
+    p->score = 0;
+    p->round_guess = '\0';
+    if (room->has_next_turn == NULL) {
+        room->has_next_turn = room->head;
+    }
+}
+
+// Tell whoever has to move next
+static void prompt(struct game_state *room, struct client **new_players) {
+    if (room->round_ms != 0) {
+        broadcast(room, "Guess a letter! Everyone guesses at once, and the "
+                  "first to guess a letter scores it\r\n");
+    } else if (room->has_next_turn != NULL) {
+        Write(room->has_next_turn->fd, "It is your turn! Please provide a "
+              "guess\r\n", room, new_players);
+    }
+}
+
+/* Introduce the players of a newly filled room to each other and start
+ * play, with one broadcast for the whole room.
+ */
+void room_start(struct game_state *room, struct client **new_players) {
+    char msg[MAX_BUF];
+    int nplayers = linked_list_size(room->head);
+    char *out = malloc(nplayers * (MAX_NAME + 2) + 2 * MAX_BUF);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    int len = sprintf(out, "Room %d is ready! Word list: %s. Players:",
+                      room->id, room->words->name);
+    for (struct client *p = room->head; p != NULL; p = p->next) {
+        len += sprintf(out + len, " %s", p->name);
+    }
+    len += sprintf(out + len, "\r\n");
+    strcpy(out + len, status_message(msg, room));
+    broadcast(room, out);
+    free(out);
+    prompt(room, new_players);
+}
+
+// Add p to a room whose game is already going on
+void room_join(struct game_state *room, struct client *p,
+               struct client **new_players) {
+    char msg[MAX_BUF];
+    room_seat(room, p);
+    sprintf(msg, "%s has just joined the game\r\n", p->name);
+    broadcast(room, msg);
+    Write(p->fd, status_message(msg, room), room, new_players);
+    if (room->round_ms != 0) {
+        Write(p->fd, "Guess a letter! Everyone guesses at once, and the "
+              "first to guess a letter scores it\r\n", room, new_players);
+    } else if (room->has_next_turn == p) {
+        Write(p->fd, "It is your turn! Please provide a guess\r\n", room,
+              new_players);
+    }
+}
+
+/* Move room on without waiting for its players: resolve the open round,
+ * or if there is none, give up on the game and start a new one.
+ */
+void room_restart(struct game_state *room, struct client **new_players) {
+    if (room->round_ms != 0 && room->round_end != 0) {
+        resolve_round(room, new_players);
+        return;
+    }
+    char msg[MAX_BUF];
+    broadcast(room, "The server has started a new game\r\n");
+    for (struct client *p = room->head; p != NULL; p = p->next) {
+        p->score = 0;
+    }
+    init_game(room);
+    broadcast(room, status_message(msg, room));
+    prompt(room, new_players);
+}
+
+// Return an open room playing words that isn't full, or NULL if there is
+// none
+struct game_state *room_with_space(struct word_list *words) {
+    for (struct game_state *room = active_rooms; room != NULL;
+         room = room->next_room) {
+        if (room->words == words && room->head != NULL &&
+            linked_list_size(room->head) < config.room_size) {
+            return room;
+        }
+    }
+    return NULL;
+}
+
+// Return the open room numbered id, or NULL if there is none
+struct game_state *room_find(int id) {
+    for (struct game_state *room = active_rooms; room != NULL;
+         room = room->next_room) {
+        if (room->id == id && room->head != NULL) {
+            return room;
+        }
+    }
+    return NULL;
+}
+
+/* Write a line listing the open rooms, with how many play and watch in
+ * each, into buf, which has room for size bytes. Rooms that don't fit are
+ * left out.
+ */
+char *room_list(char *buf, int size) {
+    int len = snprintf(buf, size, "Open rooms:");
+    for (struct game_state *room = active_rooms; room != NULL;
+         room = room->next_room) {
+        if (room->head == NULL) {
+            continue;
+        }
+        char entry[MAX_MSG];
+        int n = sprintf(entry, " %d (%s, %d playing, %d watching)",
+                        room->id, room->words->name,
+                        linked_list_size(room->head),
+                        room->spectators.count);
+        if (len + n + 3 > size) {
+            break;
+        }
+        strcpy(buf + len, entry);
+        len += n;
+    }
+    strcpy(buf + len, "\r\n");
+    return buf;
+}
+
+struct game_state *rooms_active(void) {
+    return active_rooms;
+}
+
+int rooms_count(void) {
+    return nactive;
+}
+
+/* Periodic room housekeeping: return rooms every player has left to the
+ * pool, sending their spectators back to the lobby, and resolve rounds
+ * whose time is up.
+ */
+void rooms_tick(long long now, struct client **new_players) {
+    struct game_state **r = &active_rooms;
+    while (*r != NULL) {
+        struct game_state *room = *r;
+        if (room->head == NULL) {
+            log_info("Room %d closed\n", room->id);
+            spectate_close(room);
+            if (room->evil != NULL) {
+                evil_game_free(room->evil);
+                room->evil = NULL;
+            }
+            deck_free(&room->deck);
+            word_list_release(room->words);
+            room->words = NULL;
+            room->dict = NULL;
+            *r = room->next_room;
+            room->next_room = free_rooms;
+            free_rooms = room;
+            nactive--;
+            continue;
+        }
+        if (room->round_end != 0 && now >= room->round_end) {
+            resolve_round(room, new_players);
+        }
+        spectate_retry(room);
+        r = &room->next_room;
+    }
+}
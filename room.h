@@ -0,0 +1,33 @@
+#ifndef _ROOM_H_
+#define _ROOM_H_
+
+#include "gameplay.h"
+#include "wordlist.h"
+
+/* Each room is a game_state with its own players, word and word list.
+ * Rooms are taken from a pool when the lobby fills them and go back to it
+ * once their last player leaves, letting go of their word list.
+ */
+
+// What every new room starts with
+struct room_config {
+    int round_ms;                          // 0 for turns
+    int room_size;                         // Players the lobby puts in a room
+    uint64_t seed;                         // Rooms' decks are seeded from it
+};
+
+void rooms_init(const struct room_config *config);
+struct game_state *room_new(struct word_list *words);
+void room_seat(struct game_state *room, struct client *p);
+void room_start(struct game_state *room, struct client **new_players);
+void room_join(struct game_state *room, struct client *p,
+               struct client **new_players);
+void room_restart(struct game_state *room, struct client **new_players);
+struct game_state *room_with_space(struct word_list *words);
+struct game_state *room_find(int id);
+char *room_list(char *buf, int size);
+struct game_state *rooms_active(void);
+int rooms_count(void);
+void rooms_tick(long long now, struct client **new_players);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "round.h"
+#include "clock.h"
+#include "trace.h"
+#include "stats.h"
+
+static void open_round(struct game_state *game) {
+    game->move_start = now_ms();
+    game->round_end = game->move_start + game->round_ms;
+    game->round_nletters = 0;
+    for (int i = 0; i < NUM_LETTERS; i++) {
+        game->round_first[i] = -1;
+    }
+    char buf[MAX_MSG];
+    sprintf(buf, "A new round has started! You have %d seconds to guess\r\n",
+            game->round_ms / 1000);
+    broadcast(game, buf);
+}
+
+/* Record player's guess for the open round, opening one if needed. The
+ * guess is only checked here; it is applied when the round is resolved.
+ */
+void submit_round_guess(struct game_state *game, struct client *player,
+                        char guess, struct client **new_players) {
+    if (player->round_guess != '\0') {
+        Write(player->fd, "You already guessed this round! Wait for "
+              "the results\r\n", game, new_players);
+        return;
+    }
+    if (guess < 'a' || guess > 'z' || game->letters_guessed[guess - 'a']) {
+        Write(player->fd, "The guess was invalid! Please try again with "
+              "a single lowercase letter\r\n", game, new_players);
+        return;
+    }
+    if (game->round_end == 0) {
+        open_round(game);
+    }
+
+    player->round_guess = guess;
+    player->round_guess_at = now_ms();
+    if (game->round_first[guess - 'a'] == -1) {
+        game->round_first[guess - 'a'] = player->fd;
+        game->round_order[game->round_nletters++] = guess;
+    }
+    Write(player->fd, "Your guess was received\r\n", game, new_players);
+
+    for (struct client *p = game->head; p != NULL; p = p->next) {
+        if (p->round_guess == '\0') {
+            return;
+        }
+    }
+    resolve_round(game, new_players);
+}
+
+/* Apply every guess of the open round in the order the letters were first
+ * guessed, score them, and tell everyone what happened in one broadcast.
+ * Starts a new game if the round finished this one.
+ */
+void resolve_round(struct game_state *game, struct client **new_players) {
+    TRACE_BEGIN(resolve_round);
+    int revealed[NUM_LETTERS];
+    for (int i = 0; i < game->round_nletters; i++) {
+        char letter = game->round_order[i];
+        if (is_game_over(game)) {
+            revealed[letter - 'a'] = -1;  // game ended before this letter
+        } else {
+            revealed[letter - 'a'] = apply_guess(game, letter);
+        }
+    }
+
+    int nplayers = linked_list_size(game->head);
+    char *out = malloc(nplayers * (MAX_NAME + 64) + 3 * MAX_BUF);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    int len = sprintf(out, "Round results:\r\n");
+    for (struct client *p = game->head; p != NULL; p = p->next) {
+        if (p->round_guess == '\0') {
+            continue;
+        }
+        int r = revealed[p->round_guess - 'a'];
+        int first = game->round_first[p->round_guess - 'a'] == p->fd;
+        if (r < 0) {
+            len += sprintf(out + len, "%s guessed %c, too late\r\n",
+                           p->name, p->round_guess);
+        } else if (r == 0) {
+            len += sprintf(out + len, "%s guessed %c, which was "
+                           "incorrect.\r\n", p->name, p->round_guess);
+        } else if (first) {
+            p->score += r;
+            stats_correct(p->name, p->round_guess_at - game->move_start);
+            len += sprintf(out + len, "%s guessed %c, which was correct! "
+                           "(+%d, %d points)\r\n", p->name, p->round_guess,
+                           r, p->score);
+        } else {
+            len += sprintf(out + len, "%s guessed %c, but someone else got "
+                           "there first\r\n", p->name, p->round_guess);
+        }
+    }
+    char msg[MAX_BUF];
+    strcpy(out + len, status_message(msg, game));
+    len += strlen(out + len);
+
+    struct client *winner = NULL;
+    if (is_game_over(game)) {
+        for (struct client *p = game->head; p != NULL; p = p->next) {
+            if (winner == NULL || p->score > winner->score) {
+                winner = p;
+            }
+        }
+        if (game->guesses_left == 0 || winner == NULL) {
+            winner = NULL;
+            len += sprintf(out + len, "Game over! No one won\r\n");
+        } else {
+            len += sprintf(out + len, "Game over! %s won with %d points!\r\n",
+                           winner->name, winner->score);
+        }
+        for (struct client *p = game->head; p != NULL; p = p->next) {
+            stats_game(p->name, p == winner);
+            p->score = 0;
+        }
+        init_game(game);
+        strcpy(out + len, status_message(msg, game));
+        len += strlen(out + len);
+    }
+
+    for (struct client *p = game->head; p != NULL; p = p->next) {
+        p->round_guess = '\0';
+    }
+    game->round_end = 0;
+    broadcast(game, out);
+    free(out);
+    if (winner != NULL) {
+        Write(winner->fd, "You are the winner!\r\n", game, new_players);
+    }
+    TRACE_END(resolve_round);
+}
@@ -0,0 +1,16 @@
+#ifndef _ROUND_H_
+#define _ROUND_H_
+
+#include "gameplay.h"
+
+/* Round mode: instead of taking turns, every player gets one guess per
+ * round. A round opens with the first guess and closes when everyone has
+ * guessed or round_ms has passed; all of its guesses are then applied
+ * together and the results go out in a single broadcast.
+ */
+
+void submit_round_guess(struct game_state *game, struct client *player,
+                        char guess, struct client **new_players);
+void resolve_round(struct game_state *game, struct client **new_players);
+
+#endif
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "session.h"
+#include "socket.h"
+#include "clock.h"
+#include "metrics.h"
+#include "netio.h"
+
+#define SESSION_MAGIC "WGSESS\0"
+#define SESSION_VERSION 1
+
+/* A recording is a header followed by events. Every event is a type byte
+ * and varint fields:
+ *   EV_TIME         ms since the previous EV_TIME   (starts a loop turn)
+ *   EV_ACCEPT       fd, then the peer's address as 4 bytes
+ *   EV_READ         fd, result + 1, then result bytes of data
+ *   EV_RTT          fd, round trip time in microseconds
+ *   EV_SEND_FAILED  fd
+ *   EV_SEND_STALLED fd   (netio_try_send found the socket still busy)
+ */
+#define EV_TIME 1
+#define EV_ACCEPT 2
+#define EV_READ 3
+#define EV_RTT 4
+#define EV_SEND_FAILED 5
+#define EV_SEND_STALLED 6
+
+struct session_header {
+    char magic[8];
+    uint32_t version;
+    int32_t listenfd;
+    uint64_t seed;
+};
+
+struct event {
+    int type;
+    int fd;
+    long long value;
+    const unsigned char *data;
+};
+
+int session_mode = SESSION_LIVE;
+
+static FILE *out;
+static long long last_time;
+
+static unsigned char *image;       // The whole recording, when replaying
+static const unsigned char *cursor;
+static const unsigned char *end;
+static long events;
+
+static void put_varint(unsigned long long v) {
+    while (v >= 0x80) {
+        putc((v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc(v, out);
+}
+
+void session_record(const char *path, uint64_t seed, int listenfd) {
+    out = fopen(path, "w");
+    if (out == NULL) {
+        perror("Opening session recording");
+        exit(1);
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 16);
+    struct session_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SESSION_MAGIC, 8);
+    h.version = SESSION_VERSION;
+    h.listenfd = listenfd;
+    h.seed = seed;
+    fwrite(&h, sizeof(h), 1, out);
+    session_mode = SESSION_RECORD;
+}
+
+/* Load the recording at path, and return the seed and listening
+ * descriptor of the recorded run.
+ */
+void session_replay(const char *path, uint64_t *seed, int *listenfd) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("Opening session recording");
+        exit(1);
+    }
+    image = malloc(st.st_size + 1);
+    if (image == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    off_t done = 0;
+    while (done < st.st_size) {
+        ssize_t n = read(fd, image + done, st.st_size - done);
+        if (n <= 0) {
+            perror("Reading session recording");
+            exit(1);
+        }
+        done += n;
+    }
+    close(fd);
+
+    struct session_header h;
+    if (st.st_size < sizeof(h)) {
+        fprintf(stderr, "%s is not a session recording\n", path);
+        exit(1);
+    }
+    memcpy(&h, image, sizeof(h));
+    if (memcmp(h.magic, SESSION_MAGIC, 8) != 0 ||
+        h.version != SESSION_VERSION) {
+        fprintf(stderr, "%s is not a session recording\n", path);
+        exit(1);
+    }
+    *seed = h.seed;
+    *listenfd = h.listenfd;
+    cursor = image + sizeof(h);
+    end = image + st.st_size;
+    session_mode = SESSION_REPLAY;
+}
+
+void session_close(void) {
+    if (session_mode == SESSION_RECORD) {
+        fclose(out);
+    } else if (session_mode == SESSION_REPLAY) {
+        printf("Replayed %ld events\n", events);
+        free(image);
+    }
+    session_mode = SESSION_LIVE;
+}
+
+static void truncated(void) {
+    fprintf(stderr, "The session recording is truncated\n");
+    exit(1);
+}
+
+static unsigned long long get_varint(const unsigned char **p) {
+    unsigned long long v = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (*p == end || shift > 63) {
+            truncated();
+        }
+        unsigned char b = *(*p)++;
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+}
+
+// Decode the event at *p and move *p past it
+static void decode(const unsigned char **p, struct event *ev) {
+    ev->type = *(*p)++;
+    ev->fd = -1;
+    ev->data = NULL;
+    if (ev->type == EV_TIME) {
+        ev->value = get_varint(p);
+        return;
+    }
+    ev->fd = get_varint(p);
+    if (ev->type == EV_ACCEPT) {
+        if (end - *p < 4) {
+            truncated();
+        }
+        ev->data = *p;
+        *p += 4;
+    } else if (ev->type == EV_READ) {
+        ev->value = (long long)get_varint(p) - 1;
+        if (ev->value > 0) {
+            if (end - *p < ev->value) {
+                truncated();
+            }
+            ev->data = *p;
+            *p += ev->value;
+        }
+    } else if (ev->type == EV_RTT) {
+        ev->value = get_varint(p);
+    } else if (ev->type != EV_SEND_FAILED && ev->type != EV_SEND_STALLED) {
+        fprintf(stderr, "Unknown event %d in the session recording\n",
+                ev->type);
+        exit(1);
+    }
+}
+
+/* Take the next event, which the server's handlers, doing just what they
+ * did when it was recorded, expect to be a type event for fd.
+ */
+static void expect(int type, int fd, struct event *ev) {
+    const unsigned char *at = cursor;
+    if (cursor == end) {
+        ev->type = 0;
+    } else {
+        decode(&cursor, ev);
+    }
+    if (ev->type != type || (fd >= 0 && ev->fd != fd)) {
+        fprintf(stderr, "The replay diverged from the recording at byte "
+                "%ld: expected event %d for fd %d, found event %d for "
+                "fd %d\n", (long)(at - image), type, fd, ev->type, ev->fd);
+        exit(1);
+    }
+    events++;
+}
+
+// A loop turn starts at ms
+void session_time(long long ms) {
+    if (session_mode == SESSION_RECORD) {
+        putc(EV_TIME, out);
+        put_varint(ms - last_time);
+        last_time = ms;
+    }
+}
+
+/* Start the next recorded loop turn: set the clock to its time and mark
+ * the descriptors that had input in it. Returns the number of events in
+ * the turn, or -1 when the recording is over.
+ */
+int session_replay_turn(fd_set *ready) {
+    static int listenfd = -1;
+    struct event ev;
+    FD_ZERO(ready);
+    if (cursor == end) {
+        return -1;
+    }
+    if (listenfd == -1) {
+        listenfd = ((struct session_header *)image)->listenfd;
+    }
+    expect(EV_TIME, -1, &ev);
+    last_time += ev.value;
+    clock_set(last_time);
+
+    int n = 0;
+    for (const unsigned char *p = cursor; p != end && *p != EV_TIME; n++) {
+        decode(&p, &ev);
+        if (ev.type == EV_ACCEPT) {
+            FD_SET(listenfd, ready);
+        } else if (ev.type == EV_READ) {
+            FD_SET(ev.fd, ready);
+        }
+    }
+    return n;
+}
+
+/* Accept a connection on listenfd. A replayed connection gets the
+ * descriptor it had when it was recorded, opened on /dev/null so that it
+ * can be watched and closed like a socket. The replay stops if that
+ * descriptor is one the replay has open itself. Returns -1 if no
+ * connection could be accepted; that isn't recorded.
+ */
+int session_accept(int listenfd, struct sockaddr_in *peer) {
+    if (session_mode != SESSION_REPLAY) {
+        int fd = accept_connection(listenfd, peer);
+        if (fd != -1 && session_mode == SESSION_RECORD) {
+            putc(EV_ACCEPT, out);
+            put_varint(fd);
+            fwrite(&peer->sin_addr, 4, 1, out);
+        }
+        return fd;
+    }
+    struct event ev;
+    expect(EV_ACCEPT, -1, &ev);
+    memset(peer, 0, sizeof(*peer));
+    peer->sin_family = AF_INET;
+    memcpy(&peer->sin_addr, ev.data, 4);
+    if (fcntl(ev.fd, F_GETFD) != -1) {
+        fprintf(stderr, "Can't replay the recording: a connection was "
+                "recorded on descriptor %d, which the replay is using\n",
+                ev.fd);
+        exit(1);
+    }
+    int fd = open("/dev/null", O_RDWR);
+    if (fd == -1) {
+        perror("open /dev/null");
+        exit(1);
+    }
+    if (fd != ev.fd) {
+        if (dup2(fd, ev.fd) == -1) {
+            perror("dup2");
+            exit(1);
+        }
+        close(fd);
+    }
+    return ev.fd;
+}
+
+/* Whether another connection is waiting to be accepted this turn. A
+ * replay takes as many as the recording did.
+ */
+int session_accept_more(int listenfd) {
+    if (session_mode != SESSION_REPLAY) {
+        return netio_pending(listenfd);
+    }
+    return cursor != end && *cursor == EV_ACCEPT;
+}
+
+// read(2) from a client
+int session_read(int fd, char *buf, int n) {
+    if (session_mode != SESSION_REPLAY) {
+        int nbytes = netio_read(fd, buf, n);
+        if (session_mode == SESSION_RECORD) {
+            putc(EV_READ, out);
+            put_varint(fd);
+            put_varint(nbytes + 1);
+            if (nbytes > 0) {
+                fwrite(buf, 1, nbytes, out);
+            }
+        }
+        return nbytes;
+    }
+    struct event ev;
+    expect(EV_READ, fd, &ev);
+    if (ev.value > n) {
+        fprintf(stderr, "The replay diverged from the recording: a read of "
+                "%d bytes returned %lld\n", n, ev.value);
+        exit(1);
+    }
+    if (ev.value > 0) {
+        memcpy(buf, ev.data, ev.value);
+    } else if (ev.value < 0) {
+        errno = ECONNRESET;
+    }
+    return ev.value;
+}
+
+/* The kernel's smoothed round trip time estimate for fd in microseconds,
+ * or UINT_MAX if there isn't one
+ */
+unsigned int session_rtt(int fd) {
+    if (session_mode != SESSION_REPLAY) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        unsigned int rtt = (unsigned int)-1;
+        metrics.syscalls++;
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            rtt = info.tcpi_rtt;
+        }
+        if (session_mode == SESSION_RECORD) {
+            putc(EV_RTT, out);
+            put_varint(fd);
+            put_varint(rtt);
+        }
+        return rtt;
+    }
+    struct event ev;
+    expect(EV_RTT, fd, &ev);
+    return ev.value;
+}
+
+/* The result of sending len bytes to fd during a replay: -1 if the send
+ * failed when it was recorded, len otherwise
+ */
+int session_send(int fd, int len) {
+    if (cursor != end && *cursor == EV_SEND_FAILED) {
+        const unsigned char *p = cursor;
+        struct event ev;
+        decode(&p, &ev);
+        if (ev.fd == fd) {
+            expect(EV_SEND_FAILED, fd, &ev);
+            return -1;
+        }
+    }
+    return len;
+}
+
+void session_send_failed(int fd) {
+    if (session_mode == SESSION_RECORD) {
+        putc(EV_SEND_FAILED, out);
+        put_varint(fd);
+    }
+}
+
+/* The result of trying to send len bytes to fd during a replay: 0 if fd
+ * was stalled when it was recorded, otherwise as for session_send
+ */
+int session_try_send(int fd, int len) {
+    if (cursor != end && *cursor == EV_SEND_STALLED) {
+        const unsigned char *p = cursor;
+        struct event ev;
+        decode(&p, &ev);
+        if (ev.fd == fd) {
+            expect(EV_SEND_STALLED, fd, &ev);
+            return 0;
+        }
+    }
+    return session_send(fd, len);
+}
+
+void session_send_stalled(int fd) {
+    if (session_mode == SESSION_RECORD) {
+        putc(EV_SEND_STALLED, out);
+        put_varint(fd);
+    }
+}
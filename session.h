@@ -0,0 +1,37 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdint.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+/* Everything the server learns from outside - the time of each loop turn,
+ * accepted connections, the bytes each read returns, round trip times and
+ * failed or stalled sends - goes through here. A session can be recorded to a file
+ * and later replayed: the replay feeds the recorded input to the same
+ * handlers with the recorded times and seed, without any sockets, so it
+ * takes the same decisions as the original run did. A replay must be run
+ * with the same options and word lists as the recording.
+ */
+#define SESSION_LIVE 0
+#define SESSION_RECORD 1
+#define SESSION_REPLAY 2
+
+extern int session_mode;
+
+void session_record(const char *path, uint64_t seed, int listenfd);
+void session_replay(const char *path, uint64_t *seed, int *listenfd);
+void session_close(void);
+
+void session_time(long long ms);
+int session_replay_turn(fd_set *ready);
+int session_accept(int listenfd, struct sockaddr_in *peer);
+int session_accept_more(int listenfd);
+int session_read(int fd, char *buf, int n);
+unsigned int session_rtt(int fd);
+int session_send(int fd, int len);
+void session_send_failed(int fd);
+int session_try_send(int fd, int len);
+void session_send_stalled(int fd);
+
+#endif
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,8 @@
 #include <sys/socket.h>
 
 #include "socket.h"
+#include "log.h"
+#include "netio.h"
 
 /*
  * Initialize a server address associated with the given port.
@@ -69,24 +72,39 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
 
 
 /*
- * Wait for and accept a new connection.
- * Terminate with exit code 1 if the accept call failed, otherwise return
- * the client's socket descriptor.
+ * Wait for and accept a new connection, storing the client's address
+ * in peer.
+ * Return -1 if the accept failed for want of descriptors or memory, or
+ * because the client gave up, so the caller can carry on and try again;
+ * terminate with exit code 1 on any other failure. Otherwise return the
+ * client's socket descriptor.
  */
-int accept_connection(int listenfd) {
-    struct sockaddr_in peer;
-    unsigned int peer_len = sizeof(peer);
-    peer.sin_family = PF_INET;
-
-    printf("Waiting for a new connection...\n");
-    int client_socket = accept(listenfd, (struct sockaddr *)&peer, &peer_len);
+int accept_connection(int listenfd, struct sockaddr_in *peer) {
+    static int failing = 0;  // Whether the last accept failed
+    peer->sin_family = PF_INET;
+
+    log_debug("Waiting for a new connection...\n");
+    socklen_t peer_len = sizeof(*peer);
+    int client_socket = netio_accept(listenfd, (struct sockaddr *)peer,
+                                     &peer_len);
     if (client_socket < 0) {
-        perror("accept");
+        int err = errno;
+        // Out of descriptors it fails every turn, so only say so once
+        if (!failing) {
+            perror("accept");
+        }
+        failing = 1;
+        if (err == EMFILE || err == ENFILE || err == ECONNABORTED ||
+            err == ENOBUFS || err == ENOMEM || err == EINTR ||
+            err == EAGAIN || err == EWOULDBLOCK || err == EPROTO) {
+            return -1;
+        }
         exit(1);
     } else {
-        printf("New connection accepted from %s:%d\n",
-            inet_ntoa(peer.sin_addr),
-            ntohs(peer.sin_port));
+        failing = 0;
+        log_debug("New connection accepted from %s:%d\n",
+            inet_ntoa(peer->sin_addr),
+            ntohs(peer->sin_port));
         return client_socket;
     }
 }
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "gameplay.h"
+#include "spectate.h"
+#include "lobby.h"
+#include "netio.h"
+#include "metrics.h"
+#include "trace.h"
+#include "clock.h"
+#include "log.h"
+
+static struct game_state *dirty_rooms;     // Rooms with text in pending
+static struct game_state *queue_head;      // Rooms owing spectators frames,
+static struct game_state *queue_tail;      // served in turn
+static int total;
+
+static void *grow(void *data, int *cap, int need, size_t size) {
+    if (need <= *cap) {
+        return data;
+    }
+    int n = *cap ? *cap : 16;
+    while (n < need) {
+        n *= 2;
+    }
+    data = realloc(data, n * size);
+    if (data == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    *cap = n;
+    return data;
+}
+
+// Add p, who has left the lobby, to room's spectators
+void spectate_add(struct game_state *room, struct client *p) {
+    struct room_spectators *s = &room->spectators;
+    s->watching = grow(s->watching, &s->cap, s->count + 1,
+                       sizeof(struct client *));
+    p->state = CLIENT_WATCHING;
+    p->room = room;
+    p->watch_slot = s->count;
+    p->frame_seen = s->version;   // It is sent the game's state on joining
+    p->frame_stalled = s->version - 1;
+    p->stalled_since = 0;
+    s->watching[s->count++] = p;
+    total++;
+}
+
+// Stop p watching its room. p is not freed.
+void spectate_leave(struct client *p) {
+    struct room_spectators *s = &p->room->spectators;
+    if (p->frame_stalled == s->version) {
+        s->stalled--;
+    } else if (p->frame_seen != s->version) {
+        s->stale--;
+    }
+    // The last spectator takes p's slot
+    struct client *last = s->watching[--s->count];
+    s->watching[p->watch_slot] = last;
+    last->watch_slot = p->watch_slot;
+    if (s->pos > s->count) {
+        s->pos = 0;
+    }
+    p->room = NULL;
+    total--;
+}
+
+// Stop p watching its room and close its connection
+void spectate_remove(struct client *p) {
+    spectate_leave(p);
+    // remove_player finds p at the head of a list of its own
+    struct client *top = p;
+    p->next = NULL;
+    remove_player(&top, p->fd);
+}
+
+// Send everyone watching room, whose last player has left, to the lobby
+void spectate_close(struct game_state *room) {
+    struct room_spectators *s = &room->spectators;
+    char msg[MAX_MSG];
+    sprintf(msg, "Room %d has closed. Finding you a room...\r\n", room->id);
+    while (s->count > 0) {
+        struct client *p = s->watching[s->count - 1];
+        if (p->stalled_since != 0) {
+            // It isn't reading, and writing to it could block
+            spectate_remove(p);
+            continue;
+        }
+        spectate_leave(p);
+        lobby_add(p);
+        Write(p->fd, msg, NULL, NULL);
+    }
+    s->pending.len = 0;
+}
+
+// Add text broadcast to room's players to the frame its spectators get next
+void spectate_append(struct game_state *room, const char *text) {
+    struct room_spectators *s = &room->spectators;
+    if (s->count == 0) {
+        return;
+    }
+    int len = strlen(text);
+    s->pending.data = grow(s->pending.data, &s->pending.cap,
+                           s->pending.len + len, 1);
+    memcpy(s->pending.data + s->pending.len, text, len);
+    s->pending.len += len;
+    if (!s->dirty) {
+        s->dirty = 1;
+        s->next_dirty = dirty_rooms;
+        dirty_rooms = room;
+    }
+}
+
+static void enqueue(struct game_state *room) {
+    struct room_spectators *s = &room->spectators;
+    s->queued = 1;
+    s->next_queued = NULL;
+    if (queue_tail != NULL) {
+        queue_tail->spectators.next_queued = room;
+    } else {
+        queue_head = room;
+    }
+    queue_tail = room;
+}
+
+static struct game_state *dequeue(void) {
+    struct game_state *room = queue_head;
+    queue_head = room->spectators.next_queued;
+    if (queue_head == NULL) {
+        queue_tail = NULL;
+    }
+    room->spectators.queued = 0;
+    return room;
+}
+
+/* Make what was broadcast in room this turn its latest frame. Spectators
+ * still owed the previous frame will get this one instead.
+ */
+static void publish(struct game_state *room) {
+    struct room_spectators *s = &room->spectators;
+    struct frame_buf old = s->frame;
+    s->frame = s->pending;
+    s->pending = old;
+    s->pending.len = 0;
+    s->dirty = 0;
+    metrics.frames_skipped += s->stale + s->stalled;
+    s->version++;
+    s->stale = s->count;
+    s->stalled = 0;
+    if (s->stale > 0 && !s->queued) {
+        enqueue(room);
+    }
+}
+
+/* Send room's frame to up to budget of its spectators that are owed it,
+ * carrying on from where the last call stopped. Returns the budget used.
+ */
+static int fan_out(struct game_state *room, int budget) {
+    struct room_spectators *s = &room->spectators;
+    int used = 0;
+    while (s->stale > 0 && used < budget) {
+        if (s->pos >= s->count) {
+            s->pos = 0;
+        }
+        struct client *p = s->watching[s->pos];
+        used++;
+        if (p->frame_seen == s->version || p->frame_stalled == s->version) {
+            s->pos++;
+            continue;
+        }
+        s->stale--;
+        int sent = netio_try_send(p->fd, s->frame.data, s->frame.len);
+        if (sent == 0) {
+            // Still busy with earlier frames: it stays owed this one
+            metrics.frames_stalled++;
+            p->frame_stalled = s->version;
+            s->stalled++;
+            if (p->stalled_since == 0) {
+                p->stalled_since = now_ms();
+            } else if (now_ms() - p->stalled_since >= SPECTATE_STALL_MS) {
+                log_info("Dropping spectator %s, which isn't reading\n",
+                         inet_ntoa(p->ipaddr));
+                spectate_remove(p);
+                continue;
+            }
+        } else if (sent == -1) {
+            // The last spectator moves into this slot
+            p->frame_seen = s->version;
+            spectate_remove(p);
+            continue;
+        } else {
+            p->frame_seen = s->version;
+            p->stalled_since = 0;
+            metrics.frames_sent++;
+        }
+        s->pos++;
+    }
+    return used;
+}
+
+/* Called every tick for each room: give the spectators that were passed
+ * over because they were busy another try at the latest frame
+ */
+void spectate_retry(struct game_state *room) {
+    struct room_spectators *s = &room->spectators;
+    if (s->stalled == 0) {
+        return;
+    }
+    for (int i = 0; i < s->count; i++) {
+        struct client *p = s->watching[i];
+        if (p->frame_stalled == s->version) {
+            p->frame_stalled = s->version - 1;
+            s->stale++;
+        }
+    }
+    s->stalled = 0;
+    if (!s->queued) {
+        enqueue(room);
+    }
+}
+
+/* Called once per loop turn: publish the frames of rooms that had
+ * broadcasts, then send up to FANOUT_BATCH frames, at most FANOUT_SLICE
+ * of them for a room before moving on to the next. Returns 1 if
+ * spectators are still owed frames, so the loop shouldn't wait.
+ */
+int spectate_flush(void) {
+    while (dirty_rooms != NULL) {
+        struct game_state *room = dirty_rooms;
+        dirty_rooms = room->spectators.next_dirty;
+        publish(room);
+    }
+    if (queue_head == NULL) {
+        return 0;
+    }
+
+    TRACE_BEGIN(fan_out);
+    int budget = FANOUT_BATCH;
+    while (queue_head != NULL && budget > 0) {
+        struct game_state *room = dequeue();
+        int slice = budget < FANOUT_SLICE ? budget : FANOUT_SLICE;
+        budget -= fan_out(room, slice);
+        if (room->spectators.stale > 0) {
+            enqueue(room);
+        }
+    }
+    TRACE_END(fan_out);
+    return queue_head != NULL;
+}
+
+int spectators_count(void) {
+    return total;
+}
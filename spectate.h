@@ -0,0 +1,56 @@
+#ifndef _SPECTATE_H_
+#define _SPECTATE_H_
+
+/* Spectators watch a room without playing in it. They are kept apart from
+ * the room's players, so they never take a turn and broadcasts to the
+ * players don't walk them. Everything broadcast in a room during a loop
+ * turn is collected into one frame, published at the end of the turn.
+ * A spectator is only ever owed the latest frame: one that hasn't been
+ * sent its frame before the next one is published gets the newer one
+ * instead. Frames are sent a batch at a time, taking turns between rooms,
+ * so that a room with many spectators can't hold up the event loop.
+ * Frames are only sent to a spectator whose socket has sent on the last
+ * one; one that is still busy is passed over, tried again on the next
+ * tick or frame, and dropped if it stays busy for SPECTATE_STALL_MS.
+ */
+#define FANOUT_BATCH 512   // Most frames sent per loop turn
+#define FANOUT_SLICE 64    // Most frames sent to one room before the next
+#define SPECTATE_STALL_MS 5000
+
+struct client;
+struct game_state;
+
+// A growable text buffer
+struct frame_buf {
+    char *data;
+    int len;
+    int cap;
+};
+
+// The spectators of one room, part of its game_state
+struct room_spectators {
+    struct client **watching;   // In no particular order
+    int count;
+    int cap;
+    struct frame_buf pending;   // Broadcast so far this loop turn
+    struct frame_buf frame;     // The latest published frame
+    unsigned int version;       // Of frame
+    int stale;                  // Spectators owed frame
+    int stalled;                // Spectators owed frame but passed over
+    int pos;                    // Where sending frame got to
+    int dirty;                  // pending has text
+    int queued;                 // On the fan-out queue
+    struct game_state *next_dirty;
+    struct game_state *next_queued;
+};
+
+void spectate_add(struct game_state *room, struct client *p);
+void spectate_leave(struct client *p);
+void spectate_remove(struct client *p);
+void spectate_close(struct game_state *room);
+void spectate_append(struct game_state *room, const char *text);
+void spectate_retry(struct game_state *room);
+int spectate_flush(void);
+int spectators_count(void);
+
+#endif
@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#define STATS_MAGIC "WGSTATS"
+#define STATS_VERSION 1
+// Room for a file name after the directory
+#define STATS_PATH_MAX (PATH_MAX + 32)
+
+/* Layout of the snapshot, stats.snap:
+ *   struct snapshot_header
+ *   struct stats_record records[count]   totals
+ * The log, stats.log.<gen>, is a sequence of struct stats_record holding
+ * increments. A snapshot includes every log older than its gen, so on
+ * startup the snapshot is loaded and then the logs from gen on are
+ * applied. Compaction starts a new log generation before it writes the
+ * snapshot, so a crash at any point loses nothing and counts nothing twice.
+ */
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t gen;
+};
+
+// A table of totals by name: records in an array, found through a hash
+struct stats_table {
+    struct stats_record *records;
+    int count;
+    int capacity;
+    int *slots;             // Index into records + 1, or 0 if free
+    int nslots;             // A power of two, at least twice count
+};
+
+// Owned by the event loop
+static struct stats_table table;
+static int top[LEADERBOARD_SIZE];  // Indices into table.records, best first
+static int ntop;
+
+// Shared with the flusher, under lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static struct stats_record *queue;
+static int queued;
+static int queue_capacity;
+static int stopping;
+
+// Owned by the flusher
+static pthread_t flusher;
+static int persist;
+static char dir_path[PATH_MAX];
+static struct stats_table shadow;  // What is on disk
+static uint64_t gen;
+static int log_fd = -1;
+static long long log_bytes;
+
+static void *alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+static unsigned int hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h;
+}
+
+static void rehash(struct stats_table *t) {
+    free(t->slots);
+    t->nslots = t->nslots ? t->nslots * 2 : 256;
+    t->slots = alloc(t->nslots * sizeof(int));
+    for (int i = 0; i < t->count; i++) {
+        unsigned int s = hash(t->records[i].name) & (t->nslots - 1);
+        while (t->slots[s] != 0) {
+            s = (s + 1) & (t->nslots - 1);
+        }
+        t->slots[s] = i + 1;
+    }
+}
+
+// The slot for name in t: the one holding its record, or a free one
+static unsigned int slot(const struct stats_table *t, const char *name) {
+    unsigned int s = hash(name) & (t->nslots - 1);
+    for (; t->slots[s] != 0; s = (s + 1) & (t->nslots - 1)) {
+        if (strcmp(t->records[t->slots[s] - 1].name, name) == 0) {
+            break;
+        }
+    }
+    return s;
+}
+
+// The index of name's record in t, or -1 if it has none
+static int lookup(const struct stats_table *t, const char *name) {
+    return t->nslots ? t->slots[slot(t, name)] - 1 : -1;
+}
+
+// The index of name's record in t, which is added if it isn't there
+static int find(struct stats_table *t, const char *name) {
+    if (t->nslots == 0) {
+        rehash(t);
+    }
+    unsigned int s = slot(t, name);
+    if (t->slots[s] != 0) {
+        return t->slots[s] - 1;
+    }
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 256;
+        t->records = realloc(t->records,
+                             t->capacity * sizeof(struct stats_record));
+        if (t->records == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    int i = t->count++;
+    memset(&t->records[i], 0, sizeof(struct stats_record));
+    strncpy(t->records[i].name, name, sizeof(t->records[i].name) - 1);
+    t->slots[s] = i + 1;
+    if (2 * t->count > t->nslots) {
+        rehash(t);
+    }
+    return i;
+}
+
+static void apply(struct stats_table *t, const struct stats_record *r) {
+    int i = find(t, r->name);   // May move the records
+    struct stats_record *total = &t->records[i];
+    total->games += r->games;
+    total->wins += r->wins;
+    total->correct += r->correct;
+    total->reveal_ms += r->reveal_ms;
+}
+
+// 1 if a ranks above b: more wins, then more correct guesses
+static int ranks_above(const struct stats_record *a,
+                       const struct stats_record *b) {
+    if (a->wins != b->wins) {
+        return a->wins > b->wins;
+    }
+    return a->correct > b->correct;
+}
+
+/* Totals only ever grow, so a player can only enter the leaderboard or
+ * move up it when its own record changes
+ */
+static void update_top(int i) {
+    const struct stats_record *r = table.records;
+    int pos = 0;
+    while (pos < ntop && top[pos] != i) {
+        pos++;
+    }
+    if (pos == ntop) {
+        if (ntop < LEADERBOARD_SIZE) {
+            ntop++;
+        } else if (ranks_above(&r[i], &r[top[ntop - 1]])) {
+            pos = ntop - 1;
+        } else {
+            return;
+        }
+    }
+    top[pos] = i;
+    while (pos > 0 && ranks_above(&r[top[pos]], &r[top[pos - 1]])) {
+        int t = top[pos];
+        top[pos] = top[pos - 1];
+        top[pos - 1] = t;
+        pos--;
+    }
+}
+
+// Apply an update on the event loop, and hand it to the flusher
+static void update(const struct stats_record *r) {
+    int i = find(&table, r->name);
+    apply(&table, r);
+    update_top(i);
+    if (!persist) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (queued == queue_capacity) {
+        // Grow rather than wait for the flusher
+        queue_capacity = queue_capacity ? queue_capacity * 2 : 256;
+        queue = realloc(queue, queue_capacity * sizeof(struct stats_record));
+        if (queue == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    queue[queued++] = *r;
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_correct(const char *name, long long reveal_ms) {
+    struct stats_record r;
+    memset(&r, 0, sizeof(r));
+    strncpy(r.name, name, sizeof(r.name) - 1);
+    r.correct = 1;
+    r.reveal_ms = reveal_ms > 0 ? reveal_ms : 0;
+    update(&r);
+}
+
+void stats_game(const char *name, int won) {
+    struct stats_record r;
+    memset(&r, 0, sizeof(r));
+    strncpy(r.name, name, sizeof(r.name) - 1);
+    r.games = 1;
+    r.wins = won != 0;
+    update(&r);
+}
+
+static void format_line(char *buf, const char *label,
+                        const struct stats_record *r) {
+    sprintf(buf, "%-4s %-29s %5u wins %5u games %6u correct %6.1fs per "
+            "reveal\r\n", label, r->name, r->wins, r->games, r->correct,
+            r->correct ? r->reveal_ms / 1000.0 / r->correct : 0.0);
+}
+
+/* Write the leaderboard, and name's own line if it isn't on it, into buf,
+ * which must hold MAX_LEADERBOARD bytes
+ */
+char *stats_leaderboard(char *buf, const char *name) {
+    char label[16];
+    int len = sprintf(buf, "Leaderboard:\r\n");
+    if (ntop == 0) {
+        len += sprintf(buf + len, "No games have been played yet\r\n");
+    }
+    int listed = 0;
+    for (int i = 0; i < ntop; i++) {
+        const struct stats_record *r = &table.records[top[i]];
+        sprintf(label, "%d.", i + 1);
+        format_line(buf + len, label, r);
+        len += strlen(buf + len);
+        listed |= strcmp(r->name, name) == 0;
+    }
+    int i = lookup(&table, name);
+    if (!listed && i >= 0) {
+        format_line(buf + len, "You", &table.records[i]);
+    }
+    return buf;
+}
+
+static void stats_path(char *path, const char *file, uint64_t n) {
+    if (file == NULL) {
+        snprintf(path, STATS_PATH_MAX, "%s/stats.log.%llu", dir_path,
+                 (unsigned long long)n);
+    } else {
+        snprintf(path, STATS_PATH_MAX, "%s/%s", dir_path, file);
+    }
+}
+
+static void open_log(void) {
+    char path[STATS_PATH_MAX];
+    stats_path(path, NULL, gen);
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd == -1) {
+        perror("Opening the stats log");
+        exit(1);
+    }
+    // Drop a record torn by a crash, so the next ones line up
+    struct stat st;
+    fstat(log_fd, &st);
+    log_bytes = st.st_size - st.st_size % sizeof(struct stats_record);
+    if (log_bytes != st.st_size && ftruncate(log_fd, log_bytes) == -1) {
+        perror("Truncating the stats log");
+    }
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Start a new log, write everything on disk so far into a new snapshot,
+ * and then delete the logs the snapshot includes
+ */
+static void compact(void) {
+    char path[STATS_PATH_MAX], tmp[STATS_PATH_MAX + 8];
+    uint64_t old_gen = gen;
+    int old_fd = log_fd;
+    gen++;
+    open_log();
+    // The new log takes over the old one's descriptor, so the number is
+    // never free for the main thread's accept to hand to a client while a
+    // session is being recorded
+    if (dup2(log_fd, old_fd) == -1) {
+        perror("dup2");
+        exit(1);
+    }
+    close(log_fd);
+    log_fd = old_fd;
+
+    struct snapshot_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STATS_MAGIC, 8);
+    h.version = STATS_VERSION;
+    h.count = shadow.count;
+    h.gen = gen;
+    stats_path(path, "stats.snap", 0);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write_all(fd, &h, sizeof(h)) == -1 ||
+        write_all(fd, shadow.records,
+                  shadow.count * sizeof(struct stats_record)) == -1 ||
+        fdatasync(fd) == -1 || rename(tmp, path) == -1) {
+        perror("Writing the stats snapshot");
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    close(fd);
+    for (uint64_t g = old_gen; ; g--) {
+        stats_path(path, NULL, g);
+        if (unlink(path) == -1 || g == 0) {
+            break;
+        }
+    }
+}
+
+// Write out everything queued; called by the flusher only
+static void flush(struct stats_record **batch, int *capacity) {
+    pthread_mutex_lock(&lock);
+    struct stats_record *mine = *batch;
+    int n = queued;
+    int cap = *capacity;
+    *batch = queue;
+    *capacity = queue_capacity;
+    queue = mine;
+    queue_capacity = cap;
+    queued = 0;
+    pthread_mutex_unlock(&lock);
+    if (n == 0) {
+        return;
+    }
+
+    // Every update queued since the last flush goes in one group commit
+    size_t len = n * sizeof(struct stats_record);
+    if (write_all(log_fd, *batch, len) == -1 || fdatasync(log_fd) == -1) {
+        perror("Writing the stats log");
+    }
+    log_bytes += len;
+    for (int i = 0; i < n; i++) {
+        apply(&shadow, &(*batch)[i]);
+    }
+    if (log_bytes >= STATS_COMPACT_BYTES) {
+        compact();
+    }
+}
+
+static void *flusher_main(void *arg) {
+    struct stats_record *batch = NULL;
+    int capacity = 0;
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += STATS_FLUSH_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&wake, &lock, &until);
+        pthread_mutex_unlock(&lock);
+        flush(&batch, &capacity);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    flush(&batch, &capacity);
+    free(batch);
+    return NULL;
+}
+
+// Load the snapshot, if there is one, into table and shadow
+static void load_snapshot(void) {
+    char path[STATS_PATH_MAX];
+    struct stat st;
+    stats_path(path, "stats.snap", 0);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return;
+    }
+    const char *image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    const struct snapshot_header *h = (const struct snapshot_header *)image;
+    if (memcmp(h->magic, STATS_MAGIC, 8) != 0 ||
+        h->version != STATS_VERSION ||
+        sizeof(*h) + h->count * sizeof(struct stats_record) > st.st_size) {
+        fprintf(stderr, "Ignoring the stats snapshot %s\n", path);
+    } else {
+        const struct stats_record *r =
+            (const struct stats_record *)(image + sizeof(*h));
+        for (uint32_t i = 0; i < h->count; i++) {
+            apply(&shadow, &r[i]);
+        }
+        gen = h->gen;
+    }
+    munmap((void *)image, st.st_size);
+}
+
+// Apply the logs from gen on, leaving gen at the newest
+static void replay_logs(void) {
+    char path[STATS_PATH_MAX];
+    struct stats_record r;
+    for (uint64_t g = gen; ; g++) {
+        stats_path(path, NULL, g);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            break;
+        }
+        // A torn record at the end of the last log is ignored
+        while (fread(&r, sizeof(r), 1, fp) == 1) {
+            r.name[sizeof(r.name) - 1] = '\0';
+            apply(&shadow, &r);
+        }
+        fclose(fp);
+        gen = g;
+    }
+}
+
+/* Load the statistics kept in dir and start persisting updates there.
+ * With a NULL dir the statistics only last as long as the process.
+ */
+void stats_open(const char *dir) {
+    if (dir == NULL) {
+        return;
+    }
+    snprintf(dir_path, sizeof(dir_path), "%s", dir);
+    load_snapshot();
+    replay_logs();
+    for (int i = 0; i < shadow.count; i++) {
+        apply(&table, &shadow.records[i]);
+        update_top(find(&table, shadow.records[i].name));
+    }
+    printf("Loaded statistics for %d players from %s\n", table.count, dir);
+    open_log();
+    persist = 1;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+}
+
+// Write out everything queued and stop the flusher
+void stats_close(void) {
+    if (!persist) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(flusher, NULL);
+    close(log_fd);
+    persist = 0;
+}
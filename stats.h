@@ -0,0 +1,33 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+/* Per-player statistics, by name, kept in memory for the whole server
+ * and persisted in a directory: every update is appended to a log, and
+ * the log is compacted into a snapshot now and then. The event loop only
+ * queues updates; a background thread writes each batch with a single
+ * write and fdatasync, and does the compaction.
+ */
+#define LEADERBOARD_SIZE 10
+#define MAX_LEADERBOARD 2048    // Bytes stats_leaderboard may write
+#define STATS_FLUSH_MS 200      // How often queued updates are written
+#define STATS_COMPACT_BYTES (1 << 20)   // Log size that triggers compaction
+
+// One player's totals, or in the log, one update to them
+struct stats_record {
+    char name[32];
+    uint32_t games;
+    uint32_t wins;
+    uint32_t correct;       // Guesses that revealed letters
+    uint32_t unused;
+    uint64_t reveal_ms;     // Summed over the correct guesses
+};
+
+void stats_open(const char *dir);
+void stats_close(void);
+void stats_correct(const char *name, long long reveal_ms);
+void stats_game(const char *name, int won);
+char *stats_leaderboard(char *buf, const char *name);
+
+#endif
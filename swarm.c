@@ -0,0 +1,613 @@
+/* A swarm of bots for soak testing the server. It starts wordsrv, then
+ * plays against it with many bots at once for a while, with churn: bots
+ * join, leave (sometimes in the middle of their turn) and come back, and
+ * some try a blank or taken name first. Once a second it prints the
+ * server's memory and descriptors and the move latencies it saw.
+ *
+ * At the end it fails (exit status 1) if the server died, if the 99th
+ * percentile move latency after the warmup is over its limit, if the
+ * server's memory grew by more than its limit after the warmup, or if the
+ * server still has more descriptors open after every bot has gone than
+ * it had before any came.
+ *
+ * Move latency is the time from a bot sending its guess to the server's
+ * first answer to it.
+ *
+ * Usage: swarm [options] -- wordsrv [wordsrv options]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef PORT
+    #define PORT 56408
+#endif
+#define USAGE "Usage: %s [-b bots] [-c churn_percent] [-l p99_ms] " \
+              "[-m rss_growth_kb] [-o server_log] [-p port] [-s seed] " \
+              "[-t seconds] [-T think_ms] [-w warmup_seconds] " \
+              "-- wordsrv [options]\n"
+#define MAX_BOTS 1000   // The server can't take many more connections
+#define BOT_BUF 8192
+#define LETTERS "etaoinshrdlucmfwypvbgkjqxz"
+#define WELCOME "Welcome to our word game. What is your name? "
+
+// Where a bot is
+#define BOT_OFF 0         // Disconnected, until wake_at
+#define BOT_CONNECTING 1
+#define BOT_NAMING 2      // Sent a name, not yet accepted
+#define BOT_IN 3          // In the lobby, a room or watching
+
+// How a bot answers the name prompt
+#define NAME_REAL 0
+#define NAME_BLANK 1
+#define NAME_TAKEN 2
+
+struct bot {
+    int fd;
+    int state;
+    char name[16];
+    char in[BOT_BUF];     // Input not yet split into lines
+    int in_len;
+    long long wake_at;    // When to reconnect, resend the name or guess;
+                          // 0 if nothing is due
+    long long sent_at;    // When the unanswered guess was sent, or 0
+    int my_turn;
+    int letters_next;     // The next line lists the letters guessed
+    unsigned int tried;   // Letters guessed in this game, by bit
+};
+
+// What was seen, for one interval or the whole run
+struct samples {
+    long long *us;
+    int count;
+    int cap;
+};
+
+static struct bot bots[MAX_BOTS];
+static int nbots = 200;
+static int churn = 2;          // Percent of bots that leave each second
+static int think_ms = 300;     // Bots can't guess faster than the server's
+                               // per connection limit allows
+static int port = PORT;
+static pid_t server = -1;      // Until it has exited and been reaped
+static uint64_t rng;
+static struct samples interval, overall;
+static int warm;               // Past the warmup; latencies count
+static long long joins, leaves, mid_turn_leaves, bad_names, failed_writes;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int rnd(unsigned int n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng % n;
+}
+
+static void add_sample(struct samples *s, long long us) {
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->us = realloc(s->us, s->cap * sizeof(long long));
+        if (s->us == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->us[s->count++] = us;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// The pth percentile of s, in milliseconds; sorts s
+static double percentile(struct samples *s, int p) {
+    if (s->count == 0) {
+        return 0;
+    }
+    qsort(s->us, s->count, sizeof(long long), cmp_ll);
+    int i = (long long)s->count * p / 100;
+    if (i == s->count) {
+        i--;
+    }
+    return s->us[i] / 1000.0;
+}
+
+static long rss_kb(pid_t pid) {
+    char path[64];
+    char line[256];
+    long kb = -1;
+    sprintf(path, "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+static int fd_count(pid_t pid) {
+    char path[64];
+    sprintf(path, "/proc/%d/fd", (int)pid);
+    DIR *d = opendir(path);
+    if (d == NULL) {
+        return -1;
+    }
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+/* A line that can't be written whole means the server has gone or has
+ * stopped reading; the bot is cut off, and leaves at its next read.
+ */
+static void send_line(struct bot *b, const char *line) {
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%s\r\n", line);
+    if (write(b->fd, buf, len) != len) {
+        failed_writes++;
+        shutdown(b->fd, SHUT_RDWR);
+    }
+}
+
+static void disconnect(struct bot *b, long long now) {
+    close(b->fd);
+    b->fd = -1;
+    b->state = BOT_OFF;
+    b->sent_at = 0;
+    b->my_turn = 0;
+    // Come back after a while, as someone new
+    b->wake_at = now + (100 + rnd(900)) * 1000LL;
+}
+
+static void start_connect(struct bot *b, long long now) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    b->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (b->fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+    b->in_len = 0;
+    b->wake_at = 0;
+    b->sent_at = 0;
+    b->my_turn = 0;
+    b->tried = 0;
+    b->letters_next = 0;
+    if (connect(b->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 &&
+        errno != EINPROGRESS) {
+        disconnect(b, now);
+        return;
+    }
+    b->state = BOT_CONNECTING;
+}
+
+// Answer the name prompt, with a name the server should refuse now and then
+static void send_name(struct bot *b, int how) {
+    b->state = BOT_NAMING;
+    if (how == NAME_BLANK) {
+        bad_names++;
+        send_line(b, "");
+        return;
+    }
+    if (how == NAME_TAKEN) {
+        struct bot *other = &bots[rnd(nbots)];
+        if (other != b && other->state == BOT_IN) {
+            bad_names++;
+            send_line(b, other->name);
+            return;
+        }
+    }
+    send_line(b, b->name);
+}
+
+static void guess(struct bot *b, long long now) {
+    char letter[2] = "e";
+    // Mostly common letters, never one this bot knows has been guessed
+    for (int tries = 0; tries < 64; tries++) {
+        int i = rnd(tries < 32 ? 12 : 26);
+        if (!(b->tried & (1u << (LETTERS[i] - 'a')))) {
+            letter[0] = LETTERS[i];
+            break;
+        }
+    }
+    b->tried |= 1u << (letter[0] - 'a');
+    b->sent_at = now;
+    b->wake_at = 0;
+    b->my_turn = 0;
+    send_line(b, letter);
+}
+
+// Whether line is the server answering a guess from b
+static int answers_guess(struct bot *b, const char *line) {
+    int len = strlen(b->name);
+    if (strncmp(line, b->name, len) == 0 &&
+        strncmp(line + len, " guessed ", 9) == 0) {
+        return 1;
+    }
+    return strncmp(line, "The guess was invalid", 21) == 0 ||
+           strncmp(line, "You must not play out of turn", 29) == 0 ||
+           strncmp(line, "Game is over", 12) == 0 ||
+           strncmp(line, "Your guess must be", 18) == 0;
+}
+
+static void handle_line(struct bot *b, const char *line, long long now) {
+    // The name prompt has no newline, so it can start a line
+    if (strncmp(line, WELCOME, strlen(WELCOME)) == 0) {
+        line += strlen(WELCOME);
+    }
+    if (b->sent_at != 0 && answers_guess(b, line)) {
+        long long us = now - b->sent_at;
+        add_sample(&interval, us);
+        if (warm) {
+            add_sample(&overall, us);
+        }
+        b->sent_at = 0;
+        if (strncmp(line, "The guess was invalid", 21) == 0) {
+            b->my_turn = 1;   // Still our turn
+            b->wake_at = now + think_ms * 1000LL;
+        }
+        return;
+    }
+    if (b->letters_next) {
+        b->letters_next = 0;
+        b->tried = 0;
+        for (const char *c = line; *c; c++) {
+            if (*c >= 'a' && *c <= 'z') {
+                b->tried |= 1u << (*c - 'a');
+            }
+        }
+    }
+    if (strncmp(line, "Letters guessed:", 16) == 0) {
+        b->letters_next = 1;
+    } else if (strncmp(line, "It is your turn!", 16) == 0) {
+        b->my_turn = 1;
+        b->wake_at = now + think_ms * 1000LL;
+    } else if (strstr(line, "Please choose another one") != NULL) {
+        // Give the real name, waiting a little in case it was ours that
+        // the server had not let go of yet
+        b->wake_at = now + 200000;
+    } else if (strncmp(line, "Correct name!", 13) == 0) {
+        b->state = BOT_IN;
+        joins++;
+    }
+}
+
+// Split what b has read into lines
+static void handle_input(struct bot *b, long long now) {
+    int n = read(b->fd, b->in + b->in_len, BOT_BUF - 1 - b->in_len);
+    if (n <= 0) {
+        if (n == -1 && errno == EAGAIN) {
+            return;
+        }
+        disconnect(b, now);
+        return;
+    }
+    b->in_len += n;
+    b->in[b->in_len] = '\0';
+    char *start = b->in;
+    char *end;
+    while ((end = strchr(start, '\n')) != NULL) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        handle_line(b, start, now);
+        start = end + 1;
+    }
+    // The name prompt has no newline
+    if (strcmp(start, WELCOME) == 0) {
+        start += strlen(start);
+        if (b->state == BOT_CONNECTING) {
+            int how = rnd(10);
+            send_name(b, how == 0 ? NAME_BLANK : how == 1 ? NAME_TAKEN :
+                      NAME_REAL);
+        }
+    }
+    b->in_len -= start - b->in;
+    memmove(b->in, start, b->in_len);
+    if (b->in_len == BOT_BUF - 1) {
+        b->in_len = 0;   // A line that long is no use
+    }
+}
+
+// Things due at now: reconnecting, resending the name, guessing
+static void act(struct bot *b, long long now) {
+    if (b->wake_at == 0 || now < b->wake_at) {
+        return;
+    }
+    b->wake_at = 0;
+    if (b->state == BOT_OFF) {
+        start_connect(b, now);
+    } else if (b->state == BOT_NAMING) {
+        send_name(b, NAME_REAL);
+    } else if (b->state == BOT_IN && b->my_turn) {
+        // Some leave when it's their move, which the server has to pass on
+        if ((int)rnd(400) < churn) {
+            mid_turn_leaves++;
+            leaves++;
+            disconnect(b, now);
+        } else {
+            guess(b, now);
+        }
+    }
+}
+
+static pid_t start_server(char **argv, const char *log_path) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror(log_path);
+            exit(1);
+        }
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        exit(1);
+    }
+    return pid;
+}
+
+static int server_alive(pid_t pid, int *status) {
+    if (waitpid(pid, status, WNOHANG) == 0) {
+        return 1;
+    }
+    server = -1;
+    return 0;
+}
+
+// Stop the server if it is still running; every exit goes through here
+static void stop_server(void) {
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        server = -1;
+    }
+}
+
+// Wait for the server to take connections; returns 0 once it does
+static int wait_for_server(pid_t pid) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int status;
+    for (int i = 0; i < 100 && server_alive(pid, &status); i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            close(fd);
+            return 0;
+        }
+        close(fd);
+        usleep(100000);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    int secs = 60;
+    int warmup = 10;
+    double p99_limit = 50;
+    long rss_limit = 1024;
+    char *log_path = "/dev/null";
+    rng = (uint64_t)time(NULL) * 2654435761u ^ getpid();
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:l:m:o:p:s:t:T:w:")) != -1) {
+        switch (opt) {
+        case 'b':
+            nbots = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            churn = strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            p99_limit = strtod(optarg, NULL);
+            break;
+        case 'm':
+            rss_limit = strtol(optarg, NULL, 10);
+            break;
+        case 'o':
+            log_path = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            rng = strtoull(optarg, NULL, 10) | 1;
+            break;
+        case 't':
+            secs = strtol(optarg, NULL, 10);
+            break;
+        case 'T':
+            think_ms = strtol(optarg, NULL, 10);
+            break;
+        case 'w':
+            warmup = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(1);
+        }
+    }
+    if (optind == argc || nbots <= 0 || nbots > MAX_BOTS || secs <= warmup) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    server = start_server(argv + optind, log_path);
+    atexit(stop_server);
+    int status;
+    usleep(200000);   // Let it see the probe go, or fail to bind its port
+    if (wait_for_server(server) == -1 || !server_alive(server, &status)) {
+        fprintf(stderr, "The server did not start on port %d; see %s\n",
+                port, log_path);
+        exit(1);
+    }
+    int base_fds = fd_count(server);
+    printf("Soaking for %d s with %d bots, %d%% churn a second; server "
+           "has %d descriptors\n", secs, nbots, churn, base_fds);
+
+    long long start = now_us();
+    for (int i = 0; i < nbots; i++) {
+        bots[i].fd = -1;
+        bots[i].state = BOT_OFF;
+        sprintf(bots[i].name, "bot%d", i);
+        // Arrive over the first second
+        bots[i].wake_at = start + rnd(1000000);
+    }
+
+    struct pollfd *fds = calloc(nbots, sizeof(struct pollfd));
+    long long next_sample = start + 1000000;
+    long long end = start + secs * 1000000LL;
+    long rss_warm = -1;
+    long rss = -1;
+    long long moves = 0;
+    int failed = 0;
+    long long now = start;
+    while (now < end) {
+        for (int i = 0; i < nbots; i++) {
+            fds[i].fd = bots[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, nbots, 10) == -1 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+        now = now_us();
+        for (int i = 0; i < nbots; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                handle_input(&bots[i], now);
+            }
+            act(&bots[i], now);
+        }
+
+        if (now < next_sample) {
+            continue;
+        }
+        next_sample += 1000000;
+        if (!server_alive(server, &status)) {
+            fprintf(stderr, "The server died; see %s\n", log_path);
+            exit(1);
+        }
+        // Churn: some bots leave wherever they are
+        for (int i = 0; i < nbots; i++) {
+            if (bots[i].state == BOT_IN && (int)rnd(100) < churn) {
+                leaves++;
+                disconnect(&bots[i], now);
+            }
+        }
+        int connected = 0;
+        for (int i = 0; i < nbots; i++) {
+            connected += bots[i].state != BOT_OFF;
+        }
+        rss = rss_kb(server);
+        int elapsed = (now - start) / 1000000;
+        if (!warm && elapsed >= warmup) {
+            warm = 1;
+            rss_warm = rss;
+        }
+        moves += interval.count;
+        printf("%4ds  rss %6ld kB  fds %4d  bots %4d  moves %5d/s  "
+               "p50 %7.2f ms  p99 %7.2f ms%s\n", elapsed, rss,
+               fd_count(server), connected, interval.count,
+               percentile(&interval, 50), percentile(&interval, 99),
+               warm ? "" : "  (warming up)");
+        fflush(stdout);
+        interval.count = 0;
+    }
+
+    // Everyone leaves; the server should be back where it started
+    for (int i = 0; i < nbots; i++) {
+        if (bots[i].fd != -1) {
+            close(bots[i].fd);
+        }
+    }
+    int end_fds = fd_count(server);
+    for (int i = 0; i < 30 && end_fds > base_fds; i++) {
+        usleep(100000);
+        end_fds = fd_count(server);
+    }
+
+    double p99 = percentile(&overall, 99);
+    printf("\n%lld moves, %lld joins, %lld leaves (%lld in their turn), "
+           "%lld refused names\n", moves, joins, leaves, mid_turn_leaves,
+           bad_names);
+    if (failed_writes > 0) {
+        printf("%lld lines could not be written to the server\n",
+               failed_writes);
+    }
+    printf("p99 move latency %.2f ms (limit %.2f)\n", p99, p99_limit);
+    printf("rss grew %ld kB after the warmup (limit %ld)\n",
+           rss - rss_warm, rss_limit);
+    printf("descriptors: %d before, %d after\n", base_fds, end_fds);
+    if (overall.count == 0) {
+        printf("FAIL: no moves were made\n");
+        failed = 1;
+    }
+    if (p99 > p99_limit) {
+        printf("FAIL: p99 move latency is over the limit\n");
+        failed = 1;
+    }
+    if (rss - rss_warm > rss_limit) {
+        printf("FAIL: memory grew more than the limit\n");
+        failed = 1;
+    }
+    if (end_fds > base_fds) {
+        printf("FAIL: descriptors leaked\n");
+        failed = 1;
+    }
+
+    // Have the server write its counters to the log before it goes
+    kill(server, SIGUSR1);
+    usleep(200000);
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    server = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("FAIL: the server did not exit cleanly; see %s\n", log_path);
+        failed = 1;
+    }
+    printf(failed ? "Soak failed\n" : "Soak passed\n");
+    return failed;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+struct trace_event {
+    const char *name;
+    long long start;    // ns
+    long long dur;
+};
+
+struct trace_ring {
+    struct trace_event events[TRACE_RING_SIZE];
+    unsigned long long next;    // events ever recorded
+    int tid;
+    struct trace_ring *link;    // next thread's ring
+};
+
+/* Whether spans are being recorded in this loop turn */
+int trace_active = 0;
+
+static int sample_every = 0;    // 0 = off, 1 = every turn, n = 1 in n
+static unsigned long turn;
+static __thread struct trace_ring *my_ring;
+static struct trace_ring *rings;
+
+/* Record spans in one of every sample loop turns, or never if sample is 0.
+ */
+void trace_init(int sample) {
+    sample_every = sample > 0 ? sample : 0;
+    trace_active = sample_every == 1;
+}
+
+/* Called at the top of every loop turn to decide whether it is sampled */
+void trace_tick(void) {
+    if (sample_every) {
+        trace_active = ++turn % sample_every == 0;
+    }
+}
+
+long long trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct trace_ring *new_ring(void) {
+    struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = syscall(SYS_gettid);
+    ring->link = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&rings, &ring->link, ring, 0,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_ACQUIRE)) {
+        ;
+    }
+    return ring;
+}
+
+/* Record a span that started at start (from trace_now) and ends now */
+void trace_record(const char *name, long long start) {
+    if (my_ring == NULL && (my_ring = new_ring()) == NULL) {
+        return;
+    }
+    struct trace_event *e =
+        &my_ring->events[my_ring->next & (TRACE_RING_SIZE - 1)];
+    e->name = name;
+    e->start = start;
+    e->dur = trace_now() - start;
+    __atomic_store_n(&my_ring->next, my_ring->next + 1, __ATOMIC_RELEASE);
+}
+
+/* Write every thread's recorded spans to path in Chrome trace format.
+ * Spans recorded by other threads while dumping may be torn; the loop
+ * thread's own spans are exact. Return 0 on success, -1 on error.
+ */
+int trace_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        perror("trace_dump");
+        return -1;
+    }
+    int pid = getpid();
+    int first = 1;
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (struct trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->link) {
+        unsigned long long next = __atomic_load_n(&ring->next,
+                                                  __ATOMIC_ACQUIRE);
+        unsigned long long i = next > TRACE_RING_SIZE ?
+                               next - TRACE_RING_SIZE : 0;
+        for (; i < next; i++) {
+            struct trace_event *e = &ring->events[i & (TRACE_RING_SIZE - 1)];
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                    "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    first ? "" : ",\n", e->name, e->start / 1000.0,
+                    e->dur / 1000.0, pid, ring->tid);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
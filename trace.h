@@ -0,0 +1,38 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/* Lightweight span tracing. Each thread records finished spans into its
+ * own ring of the last TRACE_RING_SIZE spans, which can be dumped as
+ * Chrome/Perfetto trace JSON (open it in chrome://tracing or
+ * ui.perfetto.dev). Spans are only recorded in sampled loop turns, so a
+ * disabled or unsampled span costs one test of trace_active. Build with
+ * -DNO_TRACE to compile the spans out entirely.
+ */
+#define TRACE_RING_SIZE 65536   // must be a power of two
+
+extern int trace_active;
+
+void trace_init(int sample);
+void trace_tick(void);
+long long trace_now(void);
+void trace_record(const char *name, long long start);
+int trace_dump(const char *path);
+
+/* TRACE_BEGIN(x) ... TRACE_END(x) records a span named x. Both must be
+ * in the same block.
+ */
+#ifdef NO_TRACE
+#define TRACE_BEGIN(span)
+#define TRACE_END(span)
+#else
+#define TRACE_BEGIN(span) \
+    long long trace_##span = trace_active ? trace_now() : 0
+#define TRACE_END(span) \
+    do { \
+        if (trace_##span) { \
+            trace_record(#span, trace_##span); \
+        } \
+    } while (0)
+#endif
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "gameplay.h"
+#include "wordlist.h"
+#include "log.h"
+#include "clock.h"
+
+static struct word_list lists[MAX_WORD_LISTS];
+static int nlists;
+static int evil;
+
+void word_lists_init(int evil_mode) {
+    evil = evil_mode;
+}
+
+/* Offer the word list at path. Terminates with exit code 1 if it can't
+ * be read, or its name is already taken, so mistakes show up at startup
+ * rather than when a room first asks for the list.
+ */
+void word_list_add(char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        perror("Opening dictionary");
+        exit(1);
+    }
+    if (nlists == MAX_WORD_LISTS) {
+        fprintf(stderr, "At most %d word lists are allowed\n",
+                MAX_WORD_LISTS);
+        exit(1);
+    }
+    struct word_list *list = &lists[nlists];
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    size_t len = strcspn(base, ".");
+    if (len == 0 || len >= MAX_NAME) {
+        fprintf(stderr, "Can't name a word list after %s\n", path);
+        exit(1);
+    }
+    memcpy(list->name, base, len);
+    list->name[len] = '\0';
+    if (word_list_find(list->name) != NULL) {
+        fprintf(stderr, "There is already a word list called %s\n",
+                list->name);
+        exit(1);
+    }
+    list->id = nlists++;
+    list->path = path;
+    printf("Offering word list %s from %s\n", list->name, path);
+}
+
+int word_lists_count(void) {
+    return nlists;
+}
+
+struct word_list *word_list_get(int id) {
+    return &lists[id];
+}
+
+struct word_list *word_list_find(const char *name) {
+    for (int i = 0; i < nlists; i++) {
+        if (strcmp(lists[i].name, name) == 0) {
+            return &lists[i];
+        }
+    }
+    return NULL;
+}
+
+// Write the names of every list into buf, separated by commas
+char *word_list_names(char *buf, int size) {
+    int len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < nlists && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s%s", i ? ", " : "",
+                        lists[i].name);
+    }
+    return buf;
+}
+
+/* Take a reference to list, loading it if it isn't loaded. Returns 0, or
+ * -1 if the list can't be loaded (its file may have been moved since
+ * startup), in which case no reference is taken.
+ */
+int word_list_acquire(struct word_list *list) {
+    if (!list->loaded) {
+        if (dict_open(&list->dict, list->path) != 0) {
+            fprintf(stderr, "Could not load word list %s\n", list->name);
+            return -1;
+        }
+        if (evil) {
+            list->evil_index = malloc(sizeof(struct evil_index));
+            if (list->evil_index == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+            evil_index_build(list->evil_index, &list->dict);
+        }
+        list->loaded = 1;
+        log_info("Loaded word list %s\n", list->name);
+    }
+    list->refs++;
+    return 0;
+}
+
+// Drop a reference to list; word_lists_tick unloads it if it stays unused
+void word_list_release(struct word_list *list) {
+    if (--list->refs == 0) {
+        list->idle_since = now_ms();
+    }
+}
+
+static void unload(struct word_list *list) {
+    if (list->evil_index != NULL) {
+        evil_index_free(list->evil_index);
+        free(list->evil_index);
+        list->evil_index = NULL;
+    }
+    dict_close(&list->dict);
+    list->loaded = 0;
+    log_info("Unloaded word list %s\n", list->name);
+}
+
+// Count the lists that are loaded but unused, waiting to be unloaded
+int word_lists_idle(void) {
+    int idle = 0;
+    for (int i = 0; i < nlists; i++) {
+        idle += lists[i].loaded && lists[i].refs == 0;
+    }
+    return idle;
+}
+
+// Unload the lists no room has used for WORD_LIST_KEEP_MS
+void word_lists_tick(long long now) {
+    for (int i = 0; i < nlists; i++) {
+        if (lists[i].loaded && lists[i].refs == 0 &&
+            now - lists[i].idle_since >= WORD_LIST_KEEP_MS) {
+            unload(&lists[i]);
+        }
+    }
+}
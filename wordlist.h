@@ -0,0 +1,40 @@
+#ifndef _WORDLIST_H_
+#define _WORDLIST_H_
+
+#include "gameplay.h"
+#include "dict.h"
+#include "evil.h"
+
+/* The word lists the server offers, each named after its file without
+ * the directory or extension (words/french.txt is "french"). Rooms choose
+ * a list when they are created. A list is loaded when the first room
+ * using it opens and shared by every room using it. Once no room uses it,
+ * it is kept for WORD_LIST_KEEP_MS in case another room wants it, then
+ * unloaded.
+ */
+#define MAX_WORD_LISTS 64
+#define WORD_LIST_KEEP_MS 60000
+
+struct word_list {
+    int id;                         // Index in the order lists were added
+    char name[MAX_NAME];
+    char *path;
+    int refs;                       // Rooms using the list
+    int loaded;
+    long long idle_since;           // When refs last dropped to 0
+    struct dictionary dict;         // Valid while loaded
+    struct evil_index *evil_index;  // Also loaded in adversarial mode
+};
+
+void word_lists_init(int evil_mode);
+void word_list_add(char *path);
+int word_lists_count(void);
+struct word_list *word_list_get(int id);
+struct word_list *word_list_find(const char *name);
+char *word_list_names(char *buf, int size);
+int word_list_acquire(struct word_list *list);
+void word_list_release(struct word_list *list);
+int word_lists_idle(void);
+void word_lists_tick(long long now);
+
+#endif
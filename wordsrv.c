@@ -14,6 +14,23 @@
 
 #include "socket.h"
 #include "gameplay.h"
+#include "netio.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "evil.h"
+#include "round.h"
+#include "clock.h"
+#include "trace.h"
+#include "names.h"
+#include "room.h"
+#include "lobby.h"
+#include "wordlist.h"
+#include "session.h"
+#include "stats.h"
+#include "spectate.h"
+#include "log.h"
+#include "admin.h"
+#include "admit.h"
 
 
 #ifndef PORT
@@ -21,12 +38,21 @@
 #endif
 #define MAX_QUEUE 5
 #define BUFSIZE 30
+#define USAGE "Usage: %s [-a admin_socket] [-b select|io_uring] " \
+              "[-d stats_dir] [-e] [-i ip_rate] [-l quiet|info|debug] " \
+              "[-n room_size] [-p recording | -s recording] " \
+              "[-r seconds] [-t sample] [-w max_wait_ms] " \
+              "<dictionary filename> [more dictionary filenames]\n"
+#define TICK_MS 100         // How often the lobby and rooms are looked after
+#define ROOM_SIZE 4
+#define MAX_WAIT 3000       // Longest wait in the lobby for a full room
 
-/* The set of socket descriptors for select to monitor.
- * This is a global variable because we need to remove socket descriptors
- * from allset when a write to a socket fails.
- */
-fd_set allset;
+// Every connected client by socket descriptor, whichever list it is on
+static struct client *clients[FD_SETSIZE];
+
+struct client *find_client(int fd) {
+    return clients[fd];
+}
 
 /* Add a client to the head of the linked list
  */
@@ -38,19 +64,26 @@ void add_player(struct client **top, int fd, struct in_addr addr) {
         exit(1);
     }
 
-    printf("Adding client %s\n", inet_ntoa(addr));
+    log_debug("Adding client %s\n", inet_ntoa(addr));
 
     p->fd = fd;
     p->ipaddr = addr;
     p->name[0] = '\0';
     p->in_ptr = p->inbuf;
     p->inbuf[0] = '\0';
+    conn_limit_init(&p->limit);
+    p->round_guess = '\0';
+    p->score = 0;
+    p->state = CLIENT_NEW;
+    p->room = NULL;
     p->next = *top;
     *top = p;
+    clients[fd] = p;
 }
 
 /* Removes client from the linked list and closes its socket.
- * Also removes socket descriptor from allset 
+ * Also stops watching the socket descriptor for input, and gives up the
+ * client's name
  */
 void remove_player(struct client **top, int fd) {
     struct client **p;
@@ -61,9 +94,14 @@ void remove_player(struct client **top, int fd) {
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
-        printf("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
-		printf("Name removed was %s\n", (*p)->name);
-        FD_CLR((*p)->fd, &allset);
+        log_debug("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
+		log_debug("Name removed was %s\n", (*p)->name);
+        if ((*p)->state != CLIENT_NEW) {
+            name_remove((*p)->name);
+        }
+        clients[fd] = NULL;
+        netio_remove((*p)->fd);
+        metrics.syscalls++;
         close((*p)->fd);
         free(*p);
         *p = t;
@@ -72,6 +110,9 @@ void remove_player(struct client **top, int fd) {
                  fd);
     }
 }
+/* Unlinks a client that has entered its name from the new players list,
+ * so that it can be queued in the lobby. The client is not freed.
+ */
 void remove_from_new(struct client **top, int fd) {
     struct client **p;
 
@@ -81,11 +122,8 @@ void remove_from_new(struct client **top, int fd) {
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
-        printf("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
-		printf("Name removed was %s\n", (*p)->name);
-        //FD_CLR((*p)->fd, &allset);
-        //close((*p)->fd);
-        //free(*p);
+        log_debug("Client %d %s is now %s\n", fd, inet_ntoa((*p)->ipaddr),
+               (*p)->name);
         *p = t;
     } else {
         fprintf(stderr, "Trying to remove fd %d, but I don't know about it\n",
@@ -93,40 +131,290 @@ void remove_from_new(struct client **top, int fd) {
     }
 }
 
-//Add a new player to the active players list in the game
-void add_active_player(struct client **top, int fd, struct in_addr addr, 
-					   char *name){
-    struct client *p = malloc(sizeof(struct client));
-    if (!p) {
-        perror("malloc");
-        exit(1);
+/* Apply the rate limits to input just read into p's inbuf, before it is
+ * parsed. Return 0 if the input can be handled. Otherwise the input has
+ * been dropped, p may have been disconnected, and 1 is returned.
+ */
+int limit_input(struct client *p, int nbytes, struct client **new_players) {
+    metrics.chunks_in++;
+    metrics.bytes_in += nbytes;
+    int verdict = ratelimit_input(&p->limit, p->ipaddr);
+    if (verdict == RATE_OK) {
+        // Make sure the next read still fits when no line ever ends
+        int len = p->in_ptr - p->inbuf;
+        if (len < MAX_BUF - MAX_NAME ||
+            find_network_newline(p->inbuf, len) > 0) {
+            return 0;
+        }
+        metrics.dropped_overflow++;
     }
-    int end;
-    if(strlen(name) >= MAX_NAME){
-	end = MAX_NAME - 1;
+
+    p->in_ptr = p->inbuf;
+    p->inbuf[0] = '\0';
+    if (verdict == RATE_WARN) {
+        Write(p->fd, "Slow down! Your input is being ignored\r\n",
+              p->room, new_players);
+    } else if (verdict == RATE_DISCONNECT) {
+        log_info("Disconnecting %s for flooding\n", inet_ntoa(p->ipaddr));
+        safe_remove(p->room, new_players, p->fd);
     }
-    else{
-		end = strlen(name);
+    return 1;
+}
+
+/* Set when SIGUSR1 asks for the metrics to be printed, or SIGUSR2 for
+ * the trace to be written out, or SIGINT or SIGTERM asks the server to
+ * finish writing statistics and any session recording, and exit
+ */
+volatile sig_atomic_t dump_metrics = 0;
+volatile sig_atomic_t dump_trace = 0;
+
+volatile sig_atomic_t stop = 0;
+
+void request_stop(int sig) {
+    stop = 1;
+}
+
+void request_dump(int sig) {
+    if (sig == SIGUSR1) {
+        dump_metrics = 1;
+    } else {
+        dump_trace = 1;
     }
+}
 
-    printf("Adding client %s\n", inet_ntoa(addr));
 
-    p->fd = fd;
-    p->ipaddr = addr;
-    //p->name = {'\0'};
-    strncpy(p->name, name, MAX_NAME);
-    p->name[end] = '\0';
+/* Move p from the lobby or its room to watching the room numbered by the
+ * rest of the watch command in cmd, or list the rooms it could watch.
+ */
+void start_watching(struct client *p, char *cmd,
+                    struct client **new_players) {
+    char msg[2 * MAX_BUF];
+    struct game_state *room = NULL;
+    if (cmd[5] == ' ') {
+        room = room_find(strtol(cmd + 6, NULL, 10));
+    }
+    if (room == NULL || (room == p->room && room->head == p &&
+                         p->next == NULL)) {
+        room_list(msg, MAX_BUF);
+        strcat(msg, "Type watch and a room number to watch it\r\n");
+        Write(p->fd, msg, NULL, new_players);
+        return;
+    }
+    if (p->state == CLIENT_LOBBY) {
+        lobby_leave(p);
+    } else {
+        leave_room(p, new_players);
+    }
+    spectate_add(room, p);
+    int len = sprintf(msg, "You are watching room %d. Type leave to go back "
+                      "to the lobby\r\n", room->id);
+    status_message(msg + len, room);
+    Write(p->fd, msg, room, new_players);
+}
+
+/* Read a guess from p, who is playing in a room. Make the move (or, in
+ * round mode, record the guess), tell the room what happened, and start a
+ * new game in the room if this one is over.
+ */
+void handle_player_input(struct client *p, struct client **new_players) {
+    struct game_state *game = p->room;
+    int cur_fd = p->fd;
+    int nbytes;
+    if ((nbytes = session_read(cur_fd, p->in_ptr, NUM_LETTERS)) <= 0) {
+        if (nbytes == -1) {
+            fprintf(stderr, "Read called failed; removing player\n");
+        }
+        safe_remove(game, new_players, cur_fd);
+        return;
+    }
+    p->in_ptr += nbytes;
+    if (limit_input(p, nbytes, new_players)) {
+        return;
+    }
+    int where;
+    if ((where = find_network_newline(p->inbuf, p->in_ptr - p->inbuf)) <= 0) {
+        return;
+    }
+    p->inbuf[where - 2] = '\0';
+    char line[MAX_BUF];
+    strcpy(line, p->inbuf);
+    char guess = line[0];
+    int len = strlen(line);
+    // Keep whatever followed the line for the next read
+    memmove(p->inbuf, &(p->inbuf[where]), p->in_ptr - p->inbuf - where);
+    p->in_ptr -= where;
+
+    if (strcmp(line, "leaderboard") == 0) {
+        char board[MAX_LEADERBOARD];
+        Write(cur_fd, stats_leaderboard(board, p->name), game, new_players);
+        return;
+    }
+    if (strncmp(line, "watch", 5) == 0 &&
+        (line[5] == '\0' || line[5] == ' ')) {
+        start_watching(p, line, new_players);
+        return;
+    }
+    if (len != 1) {
+        Write(cur_fd, "Your guess must be a single character!\r\n", game,
+              new_players);
+        return;
+    }
+    if (game->round_ms != 0) {
+        // In round mode guesses are only collected until the round ends
+        submit_round_guess(game, p, guess, new_players);
+        return;
+    }
+
+    char *whose_turn = game->has_next_turn->name;
+    TRACE_BEGIN(make_move);
+    int move_attempt = make_move(game, guess, cur_fd);
+    TRACE_END(make_move);
+    if (move_attempt == 0) {
+        stats_correct(p->name, now_ms() - game->move_start);
+    }
+    if (move_attempt >= 0) {
+        game->move_start = now_ms();
+    }
+    TRACE_BEGIN(handle_move_attempt);
+    handle_move_attempt(game, move_attempt, cur_fd, guess, whose_turn,
+                        *new_players);
+    TRACE_END(handle_move_attempt);
+    if (move_attempt < 0 || is_game_over(game) == 0) {
+        return;
+    }
+
+    int winner = has_winner(game);
+    for (struct client *q = game->head; q != NULL; q = q->next) {
+        stats_game(q->name, q->fd == winner);
+    }
+    if (winner >= 0) {
+        char winning_message[100];
+        sprintf(winning_message, "Game over! %s won!\r\n", whose_turn);
+        broadcast(game, winning_message);
+        Write(winner, "You are the winner!\r\n", game,
+              new_players);
+        advance_turn(game);
+    } else {
+        broadcast(game, "Game over! No one won\r\n");
+    }
+    init_game(game);
+
+    char msg[MAX_BUF];
+    broadcast(game, status_message(msg, game));
+    char buffer[150];
+    sprintf(buffer, "It is now %s's turn!\r\n", game->has_next_turn->name);
+    broadcast(game, buffer);
+    Write(game->has_next_turn->fd, "It is your turn! Please provide a "
+          "guess\r\n", game, new_players);
+}
+
+/* Read a name from p, a new player that has been asked for one. A whole
+ * line queues p to have the name checked; see admit.h.
+ */
+void handle_name_input(struct client *p, struct client **new_players) {
+    int cur_fd = p->fd;
+    int nbytes;
+    if ((nbytes = session_read(cur_fd, p->in_ptr, MAX_NAME)) <= 0) {
+        if (nbytes == -1) {
+            fprintf(stderr, "Read call failed when reading from new players "
+                    "list...removed that player\n");
+        }
+        safe_remove(NULL, new_players, cur_fd);
+        return;
+    }
+    p->in_ptr += nbytes;
+    if (limit_input(p, nbytes, new_players)) {
+        return;
+    }
+    int where;
+    if ((where = find_network_newline(p->inbuf, p->in_ptr - p->inbuf)) <= 0) {
+        return;
+    }
+    p->inbuf[where - 2] = '\0';
+    // Anything typed after the name is dropped
     p->in_ptr = p->inbuf;
+    admit_name(p, p->inbuf);
     p->inbuf[0] = '\0';
-    p->next = *top;
-    *top = p;
-    printf("Name added was %s\n", p->name);
+}
 
+/* A player waiting in the lobby can switch to another word list by
+ * typing its name, watch a room, or ask for the leaderboard; anything
+ * else is ignored.
+ */
+void handle_lobby_input(struct client *p, struct client **new_players) {
+    int nbytes;
+    if ((nbytes = session_read(p->fd, p->in_ptr, MAX_NAME)) <= 0) {
+        safe_remove(NULL, new_players, p->fd);
+        return;
+    }
+    p->in_ptr += nbytes;
+    if (limit_input(p, nbytes, new_players)) {
+        return;
+    }
+    int where;
+    if ((where = find_network_newline(p->inbuf, p->in_ptr - p->inbuf)) <= 0) {
+        return;
+    }
+    p->inbuf[where - 2] = '\0';
+    p->in_ptr = p->inbuf;
+    if (strcmp(p->inbuf, "leaderboard") == 0) {
+        char board[MAX_LEADERBOARD];
+        Write(p->fd, stats_leaderboard(board, p->name), NULL, new_players);
+        return;
+    }
+    if (strncmp(p->inbuf, "watch", 5) == 0 &&
+        (p->inbuf[5] == '\0' || p->inbuf[5] == ' ')) {
+        start_watching(p, p->inbuf, new_players);
+        return;
+    }
+    struct word_list *words = word_list_find(p->inbuf);
+    if (words == NULL || words == p->words) {
+        Write(p->fd, "Still finding you a room, please wait. Type watch "
+              "to watch a game meanwhile\r\n", NULL, new_players);
+        return;
+    }
+    lobby_switch(p, words);
+    char msg[MAX_MSG];
+    sprintf(msg, "You will play with the %s word list\r\n", words->name);
+    Write(p->fd, msg, NULL, new_players);
+}
+
+/* A spectator can go back to the lobby or ask for the leaderboard; it
+ * can't make moves.
+ */
+void handle_watcher_input(struct client *p, struct client **new_players) {
+    int nbytes;
+    if ((nbytes = session_read(p->fd, p->in_ptr, MAX_NAME)) <= 0) {
+        safe_remove(NULL, new_players, p->fd);
+        return;
+    }
+    p->in_ptr += nbytes;
+    if (limit_input(p, nbytes, new_players)) {
+        return;
+    }
+    int where;
+    if ((where = find_network_newline(p->inbuf, p->in_ptr - p->inbuf)) <= 0) {
+        return;
+    }
+    p->inbuf[where - 2] = '\0';
+    p->in_ptr = p->inbuf;
+    if (strcmp(p->inbuf, "leaderboard") == 0) {
+        char board[MAX_LEADERBOARD];
+        Write(p->fd, stats_leaderboard(board, p->name), NULL, new_players);
+        return;
+    }
+    if (strcmp(p->inbuf, "leave") != 0) {
+        Write(p->fd, "Spectators can't guess! Type leave to go back to "
+              "the lobby\r\n", NULL, new_players);
+        return;
+    }
+    spectate_leave(p);
+    lobby_add(p);
+    Write(p->fd, "Finding you a room...\r\n", NULL, new_players);
 }
 
 int main(int argc, char **argv) {
-    int clientfd, maxfd, nready;
-    struct client *p;
+    int clientfd, nready;
     struct sockaddr_in q;
     fd_set rset;
     
@@ -140,257 +428,317 @@ int main(int argc, char **argv) {
     	perror("sigaction");
     	exit(1);
     }
+    sa.sa_handler = request_dump;
+    if(sigaction(SIGUSR1, &sa, NULL) == -1 || 
+       sigaction(SIGUSR2, &sa, NULL) == -1) {
+    	perror("sigaction");
+    	exit(1);
+    }
+    sa.sa_handler = request_stop;
+    if(sigaction(SIGINT, &sa, NULL) == -1 || 
+       sigaction(SIGTERM, &sa, NULL) == -1) {
+    	perror("sigaction");
+    	exit(1);
+    }
     
-    if(argc != 2){
-        fprintf(stderr,"Usage: %s <dictionary filename>\n", argv[0]);
+    // -a opens an admin console on a Unix socket
+    // -b picks the I/O backend: select, or io_uring if built with it
+    // -d keeps player statistics in a directory (. by default)
+    // -e plays in adversarial mode
+    // -i sets how many reads and connections a second one address may make
+    // -l sets how much is logged to stdout
+    // -n sets how many players the lobby puts in a room
+    // -p replays the session recorded in a file, then exits
+    // -s records the session to a file
+    // -r plays in rounds of the given number of seconds instead of turns
+    // -t traces one in every sample loop turns (1 traces every turn)
+    // -w sets how long a player waits for a full room before being
+    //    placed in a room with space anyway
+    char *backend = NULL;
+    int evil_mode = 0;
+    int round_secs = 0;
+    int room_size = ROOM_SIZE;
+    int max_wait = MAX_WAIT;
+    char *stats_dir = ".";
+    char *record_path = NULL;
+    char *replay_path = NULL;
+    char *admin_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:d:ei:l:n:p:r:s:t:w:")) != -1) {
+        switch (opt) {
+        case 'a':
+            admin_path = optarg;
+            break;
+        case 'b':
+            backend = optarg;
+            break;
+        case 'd':
+            stats_dir = optarg;
+            break;
+        case 'e':
+            evil_mode = 1;
+            break;
+        case 'i': {
+            int ip_rate = strtol(optarg, NULL, 10);
+            if (ip_rate <= 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+            }
+            ratelimit_init(ip_rate);
+            break;
+        }
+        case 'l':
+            log_level = log_level_parse(optarg);
+            if (log_level == -1) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+            }
+            break;
+        case 'n':
+            room_size = strtol(optarg, NULL, 10);
+            if (room_size <= 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+            }
+            break;
+        case 'p':
+            replay_path = optarg;
+            break;
+        case 's':
+            record_path = optarg;
+            break;
+        case 'r':
+            round_secs = strtol(optarg, NULL, 10);
+            if (round_secs <= 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+            }
+            break;
+        case 't':
+            trace_init(strtol(optarg, NULL, 10));
+            break;
+        case 'w':
+            max_wait = strtol(optarg, NULL, 10);
+            if (max_wait < 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(1);
+        }
+    }
+    // The console acts on live connections, which a replay doesn't have
+    if(optind == argc || (record_path != NULL && replay_path != NULL) ||
+       (admin_path != NULL && replay_path != NULL)){
+        fprintf(stderr, USAGE, argv[0]);
         exit(1);
     }
-    
-    // Create and initialize the game state
-    struct game_state game;
 
-    srandom((unsigned int)time(NULL));
-    // Set up the file pointer outside of init_game because we want to 
-    // just rewind the file when we need to pick a new word
-    game.dict.fp = NULL;
-    game.dict.size = get_file_length(argv[1]);
+    // The first dictionary is the one players get unless they choose
+    // another. Each is only loaded while a room is using it, and shared
+    // by every room (and every server process on this host) using it.
+    word_lists_init(evil_mode);
+    for (int i = optind; i < argc; i++) {
+        word_list_add(argv[i]);
+    }
 
-    init_game(&game, argv[1]);
-    
-    // head and has_next_turn also don't change when a subsequent game is
-    // started so we initialize them here.
-    game.head = NULL;
-    game.has_next_turn = NULL;
+    // A replay takes the seed and listening descriptor of the recording
+    uint64_t seed = (uint64_t)time(NULL) << 32 ^ getpid();
+    int listenfd;
+    if (replay_path != NULL) {
+        session_replay(replay_path, &seed, &listenfd);
+        // A replay must not add to the real statistics
+        stats_dir = NULL;
+    }
+    stats_open(stats_dir);
+
+    // Every room starts from the same configuration
+    struct room_config config;
+    config.round_ms = round_secs * 1000;
+    config.room_size = room_size;
+    config.seed = seed;
+    rooms_init(&config);
+    lobby_init(room_size, max_wait);
     
     /* A list of client who have not yet entered their name.  This list is
-     * kept separate from the list of active players in the game, because
-     * until the new playrs have entered a name, they should not have a turn
+     * kept separate from the lobby and the rooms, because until the new
+     * players have entered a name, they should not be placed in a room
      * or receive broadcast messages.  In other words, they can't play until
      * they have a name.
      */
     struct client *new_players = NULL;
     
-    struct sockaddr_in *server = init_server_addr(PORT);
-    int listenfd = set_up_server_socket(server, MAX_QUEUE);
+    if (replay_path == NULL) {
+        struct sockaddr_in *server = init_server_addr(PORT);
+        listenfd = set_up_server_socket(server, MAX_QUEUE);
+        free(server);
+    } else {
+        backend = "null";
+    }
+    if (record_path != NULL) {
+        session_record(record_path, seed, listenfd);
+    }
     
-    // initialize allset and add listenfd to the
-    // set of file descriptors passed into select
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    // maxfd identifies how far into the set to search
-    maxfd = listenfd;
-
-    while (1) {
-		    // make a copy of the set before we pass it into select
-		    rset = allset;
-		    nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
-		    if (nready == -1) {
-		        perror("select");
-		        continue;
-		    }
-
-		    if (FD_ISSET(listenfd, &rset)){
-		        printf("A new client is connecting\n");
-		        clientfd = accept_connection(listenfd);
-
-		        FD_SET(clientfd, &allset);
-		        if (clientfd > maxfd) {
-		            maxfd = clientfd;
-		        }
-		        printf("Connection from %s\n", inet_ntoa(q.sin_addr));
-		        add_player(&new_players, clientfd, q.sin_addr);
-		        char *greeting = WELCOME_MSG;
-		        if(write(clientfd, greeting, strlen(greeting)) == -1) {
-		            fprintf(stderr, "Write to client %s failed\n", 
-		            		inet_ntoa(q.sin_addr));
-		            remove_player(&new_players, p->fd);
-		        };
-		    }
-		    /* Check which other socket descriptors have something ready to read
-		     * The reason we iterate over the rset descriptors at top level &
-		     * search through the two lists of clients each time is that it is
-		     * possible that a client will be removed in the middle of one
-		     * operations. This is also why we call break after handling input.
-		     * If a client has been removed the loop variables may not longer be 
-		     * valid.
-		     */
-		    int cur_fd;
-	
-		    for(cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
-		        if(FD_ISSET(cur_fd, &rset)) {
-		            // Check if this socket descriptor is an active player
-		            
-		            for(p = game.head; p != NULL; p = p->next) {
-		                if(cur_fd == p->fd) {
-		                	
-		                	//Read the player's input, check if it is just one 
-		                	//char, and then call make move...make move will 
-		                	//try to make a move, if it fails then output the 
-		                	//correct message, also whenever a move is made then
-		                	//print the state of the game. After each successful
-		                	//move, check if the game is over, and if so output
-		                	//the correct messages.
-						    int nbytes;
-							if ((nbytes = read(cur_fd, p->in_ptr, NUM_LETTERS))
-								 > 0) {
-								p->in_ptr += nbytes;
-								//moves nbytes * sizeof(char) into the array
-					    		int where;
-								if ((where = 
-									find_network_newline(p->inbuf, MAX_BUF))
-									 > 0) {
-									p->inbuf[where - 2] = '\0';
-									p->in_ptr -= where;
-									if (strlen(p->inbuf) == 1){
-									//If the user entered
-									//a char, then we can use the helpers
-										char *whose_turn =
-											 game.has_next_turn->name;
-										int move_attempt = make_move(&game, 
-														   p->inbuf[0], cur_fd);
-										handle_move_attempt(&game, move_attempt,
-										cur_fd, p->inbuf[0], whose_turn, 
-										new_players);
-										memmove(p->inbuf, &(p->inbuf[where]), 
-												p->in_ptr - p->inbuf);
-										if (is_game_over(&game) == 1){
-											if (has_winner(&game) >= 0){
-												char winning_message[100] = 
-																		{'\0'};
-												sprintf(winning_message,
-												"Game over! %s won!\r\n", 
-												whose_turn);
-												broadcast(&game, 
-														  winning_message);
-												Write(has_winner(&game), 
-													"You are the winner!\r\n", 
-													&game, &new_players);
-												advance_turn(&game);
-												
-											}
-											else {
-												char losing_message[100] = 
-																		{'\0'};
-												sprintf(losing_message, 
-												   "Game over! No one won\r\n");
-												broadcast(&game, 
-														  losing_message);
-											}
-											
-											init_game(&game, argv[1]);
-											
-											char msg[MAX_BUF];
-											broadcast(&game, 
-													  status_message(msg,
-													  				 &game));
-											char buffer[150];
-											sprintf(buffer, 
-													"It is now %s's turn!\r\n",
-													game.has_next_turn->name);
-											broadcast(&game, buffer);
-											Write(game.has_next_turn->fd, 
-													"It is your turn! Please "
-													"provide a guess\r\n", 
-													&game, &new_players);
-										}
-										
-									}
-									else {
-										Write(cur_fd, 
-											  "Your guess must be a "
-											  "single character!\r\n", &game, 
-											  &new_players);
-									}
-								}
-							}
-		                	else if (nbytes == 0){//Couldn't read anything
-		                		safe_remove(&game, &new_players, cur_fd);
-		                	}
-		                	else {//Read call returned a negative, so system err
-		                		fprintf(stderr, 
-		                			   "Read called failed; removing player\n");
-		                		safe_remove(&game, &new_players, cur_fd);
-		                	}
-		                }
-		            }
-		    
-		            // Check if any new players are entering their names
-					//Seeing if the file descriptor that got set is a new player
-		            for(p = new_players; p != NULL; p = p->next) {
-				
-		                if(cur_fd == p->fd) {
-				    		char *greeting = WELCOME_MSG;
-						    int nbytes;
-			
-							if ((nbytes = read(cur_fd, p->in_ptr, MAX_NAME)) 
-								> 0) {//Keep reading in a loop until all the 
-								//bytes have been read
-								p->in_ptr += nbytes;
-					    		int where;
-								if ((where = find_network_newline(p->inbuf, 
-									MAX_BUF)) > 0) {
-									p->inbuf[where - 2] = '\0';
-									if(check_name_valid(p->inbuf, game) == 0){
-										Write(cur_fd, "Correct name!\n", &game, 
-											&new_players); //Write to current fd
-										add_active_player(&(game.head), cur_fd, 
-														  p->ipaddr, p->inbuf);
-										if (game.has_next_turn == NULL){
-											game.has_next_turn = game.head;
-										}
-										printf("The new player added has "
-											   "name of %s\n", game.head->name);
-										printf("The new player added has fd "
-											   "of %d\n", game.head->fd);
-										//broadcast(&game, game.head->name);
-										char new_player_message[MAX_NAME] = 
-																		{'\0'};
-										sprintf(new_player_message, 
-												"%s has just joined the "
-												"game\r\n", p->inbuf);
-										broadcast(&game, new_player_message);
-										remove_from_new(&new_players, cur_fd);
-										char msg[MAX_BUF];
-										char *cur_state = status_message(msg, 
-																		 &game);
-										broadcast(&game, cur_state);
-										Write(game.has_next_turn->fd, "It is "
-										"your turn! Please provide a guess\r\n",
-										&game, &new_players);
-					
-									}
-									else{
-										Write(cur_fd, "This nickname is "
-										"already in use, or is a blank "
-										"nickname! Please choose another one\n",
-										&game, &new_players);
-										Write(cur_fd, greeting, &game,
-											  &new_players);			
-									}
-									p->inbuf[0] = '\0';
-									//Don't need anything in there, since
-									//the player was already added or has 
-									//invalid name
-								}
-								p->in_ptr -= where;
-						}
-						else if (nbytes == 0){
-							safe_remove(&game, &new_players, cur_fd);
-							
-						}
-						else {
-							safe_remove(&game, &new_players, cur_fd);
-							fprintf(stderr, "Read call failed when reading "
-							"from new players list...removed that player\n");
-						}
-				
-				
-				}
-			}
-		}
-	}
-	}
-    return 0;
-}
+    // pick the I/O backend and add listenfd to the set of
+    // file descriptors it watches
+    netio_init(backend);
+    printf("Using the %s I/O backend\n", netio_backend());
+    if (netio_listen(listenfd) == -1) {
+        exit(1);
+    }
+    if (admin_path != NULL) {
+        admin_open(admin_path);
+    }
 
+    long long next_tick = 0;
+    int placing = 0;
+    long long started = clock_read();
+    while (!stop) {
+        trace_tick();
+        // Console commands run between turns, one per connection at a time
+        int admin_left = admin_run(&new_players);
+        // Spectators get what was broadcast last turn, a batch at a time
+        int fanout_left = spectate_flush();
+        // New connections are greeted and named a batch at a time
+        int admit_left = admit_run(&new_players);
+        if (session_mode == SESSION_REPLAY) {
+            // The recording says when each turn happened and what was
+            // ready in it
+            if ((nready = session_replay_turn(&rset)) == -1) {
+                break;
+            }
+        } else {
+            // Only wake up for ticks while there is someone to look after
+            struct timeval tick_left;
+            struct timeval *timeout = NULL;
+            if (fanout_left || admin_left || admit_left || placing) {
+                tick_left.tv_sec = 0;
+                tick_left.tv_usec = 0;
+                timeout = &tick_left;
+            } else if (lobby_waiting() > 0 || rooms_count() > 0 ||
+                       word_lists_idle() > 0) {
+                long long left = next_tick - clock_read();
+                if (left < 0) {
+                    left = 0;
+                }
+                tick_left.tv_sec = left / 1000;
+                tick_left.tv_usec = (left % 1000) * 1000;
+                timeout = &tick_left;
+            }
+            TRACE_BEGIN(wait);
+            nready = netio_wait(&rset, timeout);
+            TRACE_END(wait);
+            clock_set(clock_read());
+            session_time(now_ms());
+        }
+        metrics.turns++;
+        long long now = now_ms();
+        if (now >= next_tick) {
+            TRACE_BEGIN(tick);
+            placing = 1;
+            rooms_tick(now, &new_players);
+            word_lists_tick(now);
+            next_tick = now + TICK_MS;
+            TRACE_END(tick);
+        }
+        // A crowded lobby is placed over several turns
+        if (placing) {
+            placing = lobby_tick(now, &new_players);
+        }
+        if (dump_metrics) {
+            dump_metrics = 0;
+            print_metrics(stdout);
+            printf("rooms %d\nlobby %d\nspectators %d\n", rooms_count(),
+                   lobby_waiting(), spectators_count());
+            fflush(stdout);
+        }
+        if (dump_trace) {
+            char trace_path[64];
+            dump_trace = 0;
+            sprintf(trace_path, "wordsrv-trace-%d.json", (int)getpid());
+            if (trace_dump(trace_path) == 0) {
+                printf("Trace written to %s\n", trace_path);
+            }
+        }
+        if (nready == -1) {
+            if (errno != EINTR) {
+                perror("netio_wait");
+            }
+            continue;
+        }
 
+        if (FD_ISSET(listenfd, &rset)){
+            TRACE_BEGIN(accept);
+            /* A refused connection must not cost the turn: the clients
+             * below still get read even while a flood keeps the
+             * listening socket ready. A failed accept is tried again
+             * next turn. io_uring may have accepted several already.
+             */
+            do {
+                log_debug("A new client is connecting\n");
+                clientfd = session_accept(listenfd, &q);
+                if (clientfd == -1) {
+                    log_debug("No connection accepted\n");
+                } else if (ratelimit_accept(q.sin_addr) != 0 ||
+                           netio_add(clientfd) == -1) {
+                    log_info("Refused connection from %s\n",
+                           inet_ntoa(q.sin_addr));
+                    metrics.syscalls++;
+                    close(clientfd);
+                } else {
+                    metrics.connections++;
+                    log_info("Connection from %s\n", inet_ntoa(q.sin_addr));
+                    add_player(&new_players, clientfd, q.sin_addr);
+                    admit_greet(clients[clientfd]);
+                }
+            } while (session_accept_more(listenfd));
+            TRACE_END(accept);
+        }
+        /* Check which other socket descriptors have something ready to read.
+         * The client table says where each one is, so no list has to be
+         * searched; a client removed while handling another one is simply
+         * no longer in the table.
+         */
+        int cur_fd;
+        int maxfd = netio_maxfd();
+        TRACE_BEGIN(scan);
+        for(cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
+            if(cur_fd == listenfd || !FD_ISSET(cur_fd, &rset)) {
+                continue;
+            }
+            if (admin_owns(cur_fd)) {
+                admin_ready(cur_fd);
+                continue;
+            }
+            if (clients[cur_fd] == NULL) {
+                continue;
+            }
+            struct client *p = clients[cur_fd];
+            if (p->state == CLIENT_NEW && p->handshake != HS_NAMING) {
+                // Waiting to be admitted; its input keeps until then
+                continue;
+            }
+            if (p->state == CLIENT_PLAYING) {
+                handle_player_input(p, &new_players);
+            } else if (p->state == CLIENT_LOBBY) {
+                handle_lobby_input(p, &new_players);
+            } else if (p->state == CLIENT_WATCHING) {
+                handle_watcher_input(p, &new_players);
+            } else {
+                handle_name_input(p, &new_players);
+            }
+        }
+        TRACE_END(scan);
+    }
+    if (session_mode == SESSION_REPLAY) {
+        printf("Replay took %lld ms\n", clock_read() - started);
+        print_metrics(stdout);
+    }
+    admin_close();
+    netio_close();
+    session_close();
+    stats_close();
+    return 0;
+}